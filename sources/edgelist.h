@@ -0,0 +1,113 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _EDGELIST_H_
+#define _EDGELIST_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+#include <QtGui/qopenglextrafunctions.h>
+#include <QtGui/qopenglshaderprogram.h>
+
+/**
+ * Lists of pixels for the MSAA resolve of msaa.cs built with EDGE_LIST.
+ * @details
+ * resolve() dispatches four passes. The first classifies every pixel and
+ * appends it to the list of interior or edge pixels, with one atomic
+ * counter update per workgroup and list. A single invocation then writes
+ * the number of workgroups of the shading passes from the counts. Interior
+ * and edge pixels are shaded by glDispatchComputeIndirect() each, so that
+ * no lane waits for others shading all the samples of an edge.
+ * Workgroups are laid out in rows of up to GL_MAX_COMPUTE_WORK_GROUP_COUNT
+ * in x, so large targets do not exceed the limit.
+ **/
+class EdgeList : protected QOpenGLExtraFunctions {
+public:
+    static constexpr int kListBinding = 3;
+    static constexpr int kArgsBinding = 4;
+
+    EdgeList() {
+        initializeOpenGLFunctions();
+        glGenBuffers(1, &listBuffer_);
+        glGenBuffers(1, &argsBuffer_);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, argsBuffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Args), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        GLint maxGroupsX = 65535;
+        glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &maxGroupsX);
+        maxGroupsX_ = (GLuint)std::max(maxGroupsX, 1);
+    }
+
+    EdgeList(const EdgeList &) = delete;
+    EdgeList & operator=(const EdgeList &) = delete;
+
+    virtual ~EdgeList() {
+        glDeleteBuffers(1, &listBuffer_);
+        glDeleteBuffers(1, &argsBuffer_);
+    }
+
+    //! Resolves `width` x `height` pixels with `program`, which must be bound
+    //! with the G-buffer and the render target.
+    void resolve(QOpenGLShaderProgram &program, int width, int height, int localSize) {
+        const size_t numPixels = (size_t)width * height;
+        if (numPixels == 0) {
+            return;
+        }
+
+        if (numPixels > capacity_) {
+            capacity_ = numPixels;
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, listBuffer_);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, capacity_ * sizeof(uint32_t), nullptr, GL_DYNAMIC_COPY);
+        }
+
+        const Args args = { { 0, 1, 1 }, 0, { 0, 1, 1 }, 0 };
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, argsBuffer_);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(Args), &args);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kListBinding, listBuffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kArgsBinding, argsBuffer_);
+        glUniform2i(program.uniformLocation("u_targetSize"), width, height);
+        program.setUniformValue("u_maxGroupsX", maxGroupsX_);
+
+        const size_t numGroups = (numPixels + localSize - 1) / localSize;
+        const GLuint groupsX = (GLuint)std::min(numGroups, (size_t)maxGroupsX_);
+        const GLuint groupsY = (GLuint)((numGroups + groupsX - 1) / groupsX);
+        program.setUniformValue("u_pass", 0);
+        glDispatchCompute(groupsX, groupsY, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        program.setUniformValue("u_pass", 3);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, argsBuffer_);
+        program.setUniformValue("u_pass", 1);
+        glDispatchComputeIndirect(offsetof(Args, interiorGroups));
+        program.setUniformValue("u_pass", 2);
+        glDispatchComputeIndirect(offsetof(Args, edgeGroups));
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kListBinding, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kArgsBinding, 0);
+    }
+
+private:
+    //! Layout of `ResolveArgs` in msaa.cs (std430).
+    struct Args {
+        uint32_t interiorGroups[3];
+        uint32_t interiorCount;
+        uint32_t edgeGroups[3];
+        uint32_t edgeCount;
+    };
+
+    GLuint listBuffer_ = 0;
+    GLuint argsBuffer_ = 0;
+    size_t capacity_ = 0;
+    GLuint maxGroupsX_ = 65535;
+};
+
+#endif  // _EDGELIST_H_
@@ -0,0 +1,199 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _GBUFFER_H_
+#define _GBUFFER_H_
+
+#include <cstdio>
+#include <algorithm>
+
+#include <QtGui/qopenglcontext.h>
+#include <QtGui/qopenglextrafunctions.h>
+
+#include "glutils.h"
+
+/**
+ * Framebuffer of the deferred passes.
+ * @details
+ * Each sample holds 12 bytes:
+ * - depth: 32-bit float depth, from which the position is reconstructed.
+ * - normal: RG16UI, 12-bit octahedral coordinates of the normal in the
+ *   upper bits of each channel and 8 bits of log-encoded shininess in the
+ *   lower 4 bits of both.
+ * - albedo: RGBA8, diffuse color and specular intensity in alpha.
+ * Encoding and decoding are done in gbuffer.fs and msaa.cs.
+ * With `samples` > 1, the textures are multisampled, so fragments are shaded
+ * once per pixel and depth and coverage are kept per sample. The count is
+ * limited by the device, and the one actually allocated is samples().
+ * Textures are allocated at power-of-two sizes and reused by resize() while
+ * the size fits, so only the bottom-left width() x height() is drawn.
+ **/
+class GBuffer : protected QOpenGLExtraFunctions {
+public:
+    static constexpr int kNumColorTargets = 2;
+
+    GBuffer(int width, int height, int samples = 1) {
+        initializeOpenGLFunctions();
+
+        if (samples > 1) {
+            // The normal target is an integer one.
+            GLint maxColor = 1, maxDepth = 1, maxInteger = 1;
+            glGetIntegerv(GL_MAX_COLOR_TEXTURE_SAMPLES, &maxColor);
+            glGetIntegerv(GL_MAX_DEPTH_TEXTURE_SAMPLES, &maxDepth);
+            glGetIntegerv(GL_MAX_INTEGER_SAMPLES, &maxInteger);
+            samples = std::min(samples, std::min(maxColor, std::min(maxDepth, maxInteger)));
+        }
+        samples_ = std::max(samples, 1);
+        resize(width, height);
+    }
+
+    GBuffer(const GBuffer &) = delete;
+    GBuffer & operator=(const GBuffer &) = delete;
+
+    virtual ~GBuffer() {
+        deallocate();
+    }
+
+    //! Textures are reallocated only when the size does not fit in them.
+    void resize(int width, int height) {
+        width_ = width;
+        height_ = height;
+        if (fbo_ && width <= capacityWidth_ && height <= capacityHeight_) {
+            return;
+        }
+
+        deallocate();
+        capacityWidth_ = nextPowerOfTwo(width);
+        capacityHeight_ = nextPowerOfTwo(height);
+
+        depth_ = createTexture(GL_DEPTH_COMPONENT32F);
+        normal_ = createTexture(GL_RG16UI);
+        albedo_ = createTexture(GL_RGBA8);
+
+        glGenFramebuffers(1, &fbo_);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, target(), depth_, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target(), normal_, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, target(), albedo_, 0);
+
+        const GLenum bufs[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(kNumColorTargets, bufs);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            printf("[WARNING] G-buffer is incomplete.\n");
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, QOpenGLContext::currentContext()->defaultFramebufferObject());
+    }
+
+    //! Reallocates the textures when they are larger than resize() would
+    //! allocate for the current size, e.g., after a larger size was used once.
+    void shrink() {
+        if (capacityWidth_ > nextPowerOfTwo(width_) || capacityHeight_ > nextPowerOfTwo(height_)) {
+            deallocate();
+            resize(width_, height_);
+        }
+    }
+
+    //! Binds the framebuffer with the viewport and the scissor box on the
+    //! part in use. The scissor test is enabled until release().
+    void bind() {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+        glViewport(0, 0, width_, height_);
+        glScissor(0, 0, width_, height_);
+        glEnable(GL_SCISSOR_TEST);
+    }
+
+    void release() {
+        glDisable(GL_SCISSOR_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, QOpenGLContext::currentContext()->defaultFramebufferObject());
+    }
+
+    //! Clears the bound G-buffer. glClear() is undefined for the integer
+    //! normal target.
+    void clear() {
+        const GLuint zeroU[4] = { 0, 0, 0, 0 };
+        const GLfloat zeroF[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        const GLfloat far = 1.0f;
+        glClearBufferuiv(GL_COLOR, 0, zeroU);
+        glClearBufferfv(GL_COLOR, 1, zeroF);
+        glClearBufferfv(GL_DEPTH, 0, &far);
+    }
+
+    int width() const {
+        return width_;
+    }
+
+    int height() const {
+        return height_;
+    }
+
+    int samples() const {
+        return samples_;
+    }
+
+    //! GL_TEXTURE_2D_MULTISAMPLE if multisampled, or GL_TEXTURE_2D.
+    GLenum target() const {
+        return samples_ > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+    }
+
+    GLuint depthTexture() const {
+        return depth_;
+    }
+
+    GLuint normalTexture() const {
+        return normal_;
+    }
+
+    GLuint albedoTexture() const {
+        return albedo_;
+    }
+
+private:
+    GLuint createTexture(GLenum internalFormat) {
+        GLuint texture = 0;
+        glGenTextures(1, &texture);
+        if (samples_ > 1) {
+            // Same sample positions in all the targets.
+            glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, texture);
+            glTexStorage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, samples_, internalFormat,
+                                      capacityWidth_, capacityHeight_, GL_TRUE);
+
+            GLint samples = samples_;
+            glGetTexLevelParameteriv(GL_TEXTURE_2D_MULTISAMPLE, 0, GL_TEXTURE_SAMPLES, &samples);
+            samples_ = std::max((int)samples, samples_);
+            glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+            return texture;
+        }
+
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, capacityWidth_, capacityHeight_);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+
+    void deallocate() {
+        if (fbo_) {
+            glDeleteFramebuffers(1, &fbo_);
+            const GLuint textures[] = { depth_, normal_, albedo_ };
+            glDeleteTextures(3, textures);
+            fbo_ = depth_ = normal_ = albedo_ = 0;
+        }
+    }
+
+    int width_ = 0;
+    int height_ = 0;
+    int capacityWidth_ = 0;
+    int capacityHeight_ = 0;
+    int samples_ = 1;
+    GLuint fbo_ = 0;
+    GLuint depth_ = 0;
+    GLuint normal_ = 0;
+    GLuint albedo_ = 0;
+};
+
+#endif  // _GBUFFER_H_
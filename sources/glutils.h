@@ -5,16 +5,129 @@
 #ifndef _GL_UTILS_H_
 #define _GL_UTILS_H_
 
+#include <cstdint>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
+#include <QtCore/qfile.h>
+#include <QtCore/qfileinfo.h>
+#include <QtCore/qstringlist.h>
+#include <QtGui/qopenglbuffer.h>
+#include <QtGui/qopenglcontext.h>
+#include <QtGui/qopenglextrafunctions.h>
 #include <QtGui/qopenglshaderprogram.h>
 
-inline QOpenGLShaderProgram *buildGLSLComputeShader(const QString &progCS) {
-    auto shader = new QOpenGLShaderProgram();
-    shader->addShaderFromSourceFile(QOpenGLShader::Compute, progCS + ".cs");
-    shader->link();
-    if (!shader->isLinked()) {
+#include "programcache.h"
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_DYNAMIC_STORAGE_BIT
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#endif
+
+typedef void (QOPENGLF_APIENTRYP GLBufferStorageProc)(GLenum target, GLsizeiptr size,
+                                                       const void *data, GLbitfield flags);
+typedef void (QOPENGLF_APIENTRYP GLDrawElementsInstancedBaseInstanceProc)(GLenum mode, GLsizei count,
+                                                                           GLenum type, const void *indices,
+                                                                           GLsizei instancecount,
+                                                                           GLuint baseinstance);
+typedef void (QOPENGLF_APIENTRYP GLMultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void *indirect,
+                                                                   GLsizei drawcount, GLsizei stride);
+typedef void (QOPENGLF_APIENTRYP GLCopyImageSubDataProc)(GLuint srcName, GLenum srcTarget, GLint srcLevel,
+                                                          GLint srcX, GLint srcY, GLint srcZ,
+                                                          GLuint dstName, GLenum dstTarget, GLint dstLevel,
+                                                          GLint dstX, GLint dstY, GLint dstZ,
+                                                          GLsizei srcWidth, GLsizei srcHeight, GLsizei srcDepth);
+
+//! Entry point of an OpenGL function which QOpenGLExtraFunctions does not
+//! provide, or nullptr if the context is older than `major`.`minor`.
+template <class Proc>
+inline Proc glProcAddress(const char *name, int major, int minor) {
+    QOpenGLContext *ctx = QOpenGLContext::currentContext();
+    if (!ctx || ctx->format().version() < qMakePair(major, minor)) {
+        return nullptr;
+    }
+    return (Proc)ctx->getProcAddress(name);
+}
+
+//! glBufferStorage of ARB_buffer_storage (OpenGL 4.4), or nullptr if it is not supported.
+inline GLBufferStorageProc glBufferStorageFunc() {
+    QOpenGLContext *ctx = QOpenGLContext::currentContext();
+    if (!ctx) {
+        return nullptr;
+    }
+    if (ctx->format().version() < qMakePair(4, 4) && !ctx->hasExtension("GL_ARB_buffer_storage")) {
+        return nullptr;
+    }
+    return (GLBufferStorageProc)ctx->getProcAddress("glBufferStorage");
+}
+
+//! Allocates immutable storage for `buffer` initialized with `data`, which
+//! lets the driver place it in video memory for good. Falls back to
+//! QOpenGLBuffer::allocate() without ARB_buffer_storage.
+//! The buffer must be created and bound.
+inline void allocateImmutable(QOpenGLBuffer &buffer, const void *data, size_t size) {
+    static const GLBufferStorageProc bufferStorage = glBufferStorageFunc();
+    if (!bufferStorage) {
+        buffer.allocate(data, (int)size);
+        return;
+    }
+
+    const GLenum target = buffer.type() == QOpenGLBuffer::IndexBuffer ? GL_ELEMENT_ARRAY_BUFFER : GL_ARRAY_BUFFER;
+    bufferStorage(target, size, data, 0);
+}
+
+//! Smallest power of two not less than `size`, used to bucket the sizes of
+//! render targets.
+inline int nextPowerOfTwo(int size) {
+    int p = 1;
+    while (p < size) {
+        p <<= 1;
+    }
+    return p;
+}
+
+//! Reads the shader `filename` with `defines` inserted after its #version
+//! line. Returns an empty array if the file cannot be read.
+inline QByteArray loadShaderSource(const QString &filename, const QByteArray &defines) {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        std::cerr << "[ERROR] failed to open shader: " << filename.toStdString() << std::endl;
+        return QByteArray();
+    }
+
+    QByteArray source = file.readAll();
+    const int eol = source.indexOf('\n');
+    source.insert(eol >= 0 ? eol + 1 : 0, defines);
+    return source;
+}
+
+//! Name of a program in messages, the file names of its stages.
+inline QString programName(const QStringList &files) {
+    QStringList names;
+    for (const auto &file : files) {
+        names << QFileInfo(file).fileName();
+    }
+    return names.join(", ");
+}
+
+//! Builds `progCS`.cs with `defines` inserted after its #version line.
+//! Programs are built through ProgramCache.
+inline QOpenGLShaderProgram *buildGLSLComputeShader(const QString &progCS, const QByteArray &defines = QByteArray()) {
+    auto shader = ProgramCache::build(programName({ progCS + ".cs" }), {
+        { QOpenGLShader::Compute, loadShaderSource(progCS + ".cs", defines) },
+    });
+    if (!shader) {
         std::cerr << "[ERROR] failed to compile or link shader: " << std::endl;
         std::cerr << "   Compute: " << progCS.toStdString() << std::endl;
         return nullptr;
@@ -26,11 +139,11 @@ inline QOpenGLShaderProgram *buildGLSLComputeShader(const QString &progCS) {
 inline QOpenGLShaderProgram *buildGLSLProgram(const QString &progVS,
     const QString &progFS) {
 
-    auto shader = new QOpenGLShaderProgram();
-    shader->addShaderFromSourceFile(QOpenGLShader::Vertex, progVS);
-    shader->addShaderFromSourceFile(QOpenGLShader::Fragment, progFS);
-    shader->link();
-    if (!shader->isLinked()) {
+    auto shader = ProgramCache::build(programName({ progVS, progFS }), {
+        { QOpenGLShader::Vertex, loadShaderSource(progVS, QByteArray()) },
+        { QOpenGLShader::Fragment, loadShaderSource(progFS, QByteArray()) },
+    });
+    if (!shader) {
         std::cerr << "[ERROR] failed to compile or link shader: " << std::endl;
         std::cerr << "    Vertex: " << progVS.toStdString() << std::endl;
         std::cerr << "  Fragment: " << progFS.toStdString() << std::endl;
@@ -43,12 +156,12 @@ inline QOpenGLShaderProgram *buildGLSLProgram(const QString &progVS,
 inline QOpenGLShaderProgram *buildGLSLProgram(const QString &progVS,
     const QString &progGS, const QString &progFS) {
 
-    auto shader = new QOpenGLShaderProgram();
-    shader->addShaderFromSourceFile(QOpenGLShader::Vertex, progVS);
-    shader->addShaderFromSourceFile(QOpenGLShader::Geometry, progGS);
-    shader->addShaderFromSourceFile(QOpenGLShader::Fragment, progFS);
-    shader->link();
-    if (!shader->isLinked()) {
+    auto shader = ProgramCache::build(programName({ progVS, progGS, progFS }), {
+        { QOpenGLShader::Vertex, loadShaderSource(progVS, QByteArray()) },
+        { QOpenGLShader::Geometry, loadShaderSource(progGS, QByteArray()) },
+        { QOpenGLShader::Fragment, loadShaderSource(progFS, QByteArray()) },
+    });
+    if (!shader) {
         std::cerr << "[ERROR] failed to compile or link shader: " << std::endl;
         std::cerr << "    Vertex: " << progVS.toStdString() << std::endl;
         std::cerr << "  Geometry: " << progGS.toStdString() << std::endl;
@@ -72,4 +185,65 @@ inline QOpenGLShaderProgram *buildGLSLProgram(const QString& basename, bool useG
     return buildGLSLProgram(progVS, progFS);
 }
 
+/**
+ * Variants of the program `basename`.vs and `basename`.fs.
+ * @details
+ * Bit i of the mask given to program() is defined as 1 or 0 by the name
+ * `features[i]` after the #version line of both stages, so the shaders can
+ * test it as a constant. Programs are linked on first use and cached by the
+ * mask. A program which fails to build is cached as nullptr.
+ **/
+class ShaderPermutations {
+public:
+    ShaderPermutations(const QString &basename, const std::vector<QByteArray> &features)
+        : basename_(basename)
+        , features_(features) {
+    }
+
+    ShaderPermutations(const ShaderPermutations &) = delete;
+    ShaderPermutations & operator=(const ShaderPermutations &) = delete;
+
+    QOpenGLShaderProgram *program(uint32_t mask) {
+        auto it = programs_.find(mask);
+        if (it != programs_.end()) {
+            return it->second.get();
+        }
+
+        auto &program = programs_[mask];
+        program.reset(build(mask));
+        return program.get();
+    }
+
+    //! Number of programs built so far.
+    size_t size() const {
+        return programs_.size();
+    }
+
+private:
+    QOpenGLShaderProgram *build(uint32_t mask) const {
+        QByteArray defines;
+        for (size_t i = 0; i < features_.size(); i++) {
+            defines += "#define " + features_[i] + ((mask >> i) & 1 ? " 1\n" : " 0\n");
+        }
+
+        const QString name = programName({ basename_ + ".vs", basename_ + ".fs" }) +
+                             QString(" (%1)").arg(mask);
+        auto shader = ProgramCache::build(name, {
+            { QOpenGLShader::Vertex, loadShaderSource(basename_ + ".vs", defines) },
+            { QOpenGLShader::Fragment, loadShaderSource(basename_ + ".fs", defines) },
+        });
+        if (!shader) {
+            std::cerr << "[ERROR] failed to compile or link shader: " << std::endl;
+            std::cerr << "  Permutation: " << basename_.toStdString() << " (" << mask << ")" << std::endl;
+            return nullptr;
+        }
+
+        return shader;
+    }
+
+    const QString basename_;
+    const std::vector<QByteArray> features_;
+    std::map<uint32_t, std::unique_ptr<QOpenGLShaderProgram>> programs_;
+};
+
 #endif // _GL_UTILS_H_
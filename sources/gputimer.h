@@ -0,0 +1,104 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _GPUTIMER_H_
+#define _GPUTIMER_H_
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include <QtCore/qvector.h>
+#include <QtGui/qopengltimemonitor.h>
+
+/**
+ * GPU time of the passes of a frame, measured with timer queries.
+ * @details
+ * Results are read a few frames later, when they are available, so the
+ * measurement never waits for GPU. A frame is not measured when all the
+ * queries are still in flight. Times are averaged over frames.
+ *
+ * -- Usage --
+ * 1) call begin() before the first pass.
+ * 2) call mark() after each pass, `numIntervals` times in total.
+ * 3) call end() at the end of the frame.
+ **/
+class GpuTimer {
+public:
+    explicit GpuTimer(int numIntervals, int numFrames = 3)
+        : pending_(numFrames, false)
+        , averageMs_(numIntervals, 0.0) {
+        for (int i = 0; i < numFrames; i++) {
+            auto monitor = std::make_unique<QOpenGLTimeMonitor>();
+            monitor->setSampleCount(numIntervals + 1);
+            if (!monitor->create()) {
+                printf("[WARNING] timer queries are not supported.\n");
+                monitors_.clear();
+                break;
+            }
+            monitors_.push_back(std::move(monitor));
+        }
+    }
+
+    void begin() {
+        active_ = false;
+        if (monitors_.empty()) {
+            return;
+        }
+
+        auto &monitor = monitors_[current_];
+        if (pending_[current_]) {
+            if (!monitor->isResultAvailable()) {
+                return;
+            }
+            collect(*monitor);
+            monitor->reset();
+            pending_[current_] = false;
+        }
+        monitor->recordSample();
+        active_ = true;
+    }
+
+    void mark() {
+        if (active_) {
+            monitors_[current_]->recordSample();
+        }
+    }
+
+    void end() {
+        if (active_) {
+            pending_[current_] = true;
+            current_ = (current_ + 1) % (int)monitors_.size();
+            active_ = false;
+        }
+    }
+
+    //! Time of interval `i` in milliseconds, averaged over frames.
+    double intervalMs(int i) const {
+        return averageMs_[i];
+    }
+
+    void clear() {
+        std::fill(averageMs_.begin(), averageMs_.end(), 0.0);
+    }
+
+private:
+    void collect(QOpenGLTimeMonitor &monitor) {
+        // Available, so this does not wait.
+        const QVector<GLuint64> intervals = monitor.waitForIntervals();
+        for (int i = 0; i < (int)averageMs_.size() && i < intervals.size(); i++) {
+            const double ms = intervals[i] * 1.0e-6;
+            averageMs_[i] = averageMs_[i] > 0.0 ? averageMs_[i] * 0.95 + ms * 0.05 : ms;
+        }
+    }
+
+    std::vector<std::unique_ptr<QOpenGLTimeMonitor>> monitors_;
+    std::vector<bool> pending_;
+    std::vector<double> averageMs_;
+    int current_ = 0;
+    bool active_ = false;
+};
+
+#endif  // _GPUTIMER_H_
@@ -5,12 +5,16 @@
 #ifndef _IMAGETEXTURE_H_
 #define _IMAGETEXTURE_H_
 
-#include <memory>
 #include <QtGui/qimage.h>
 #include <QtGui/qvector2d.h>
 #include <QtGui/qvector3d.h>
-#include <QtGui/qopengltexture.h>
 
+/**
+ * Image of a material texture.
+ * @details
+ * The GPU copy is owned by MaterialTable, which calls releaseImage() once
+ * the image is uploaded. hasImage() stays true after the release.
+ **/
 class ImageTexture {
 public:
     ImageTexture()
@@ -31,7 +35,8 @@ public:
     }
 
     ImageTexture & operator=(const ImageTexture &texture) {
-        setImage(texture.image_);
+        this->image_ = texture.image_;
+        this->hasImage_ = texture.hasImage_;
         return *this;
     }
 
@@ -58,27 +63,25 @@ public:
 
     void setImage(const QImage &image) {
         this->image_ = image;
-        this->texture_ = std::make_shared<QOpenGLTexture>(image.mirrored(),
-            QOpenGLTexture::MipMapGeneration::DontGenerateMipMaps);
-        texture_->setWrapMode(QOpenGLTexture::CoordinateDirection::DirectionS, QOpenGLTexture::WrapMode::Repeat);
-        texture_->setWrapMode(QOpenGLTexture::CoordinateDirection::DirectionT, QOpenGLTexture::WrapMode::Repeat);
+        this->hasImage_ = !image.isNull();
     }
 
-    void bind() {
-        texture_->bind();
+    //! Frees the host copy of the image.
+    void releaseImage() {
+        image_ = QImage();
     }
 
-    void release() {
-        texture_->release();
+    bool hasImage() const {
+        return hasImage_;
     }
 
-    GLuint textureId() const {
-        return texture_->textureId();
+    const QImage & image() const {
+        return image_;
     }
 
 private:
     QImage image_;
-    std::shared_ptr<QOpenGLTexture> texture_;
+    bool hasImage_ = false;
 };
 
 #endif  // _IMAGETEXTURE_H_
@@ -2,6 +2,7 @@
 
 #include <QtCore/qelapsedtimer.h>
 #include <QtWidgets/qboxlayout.h>
+#include <QtWidgets/qcheckbox.h>
 #include <QtWidgets/qlabel.h>
 #include <QtWidgets/qlineedit.h>
 #include <QtWidgets/qpushbutton.h>
@@ -30,6 +31,35 @@ public:
 
         updateButton = new QPushButton("Update", this);
         layout->addWidget(updateButton);
+
+        indirectDrawCheck = new QCheckBox("Indirect draw", this);
+        indirectDrawCheck->setChecked(true);
+        layout->addWidget(indirectDrawCheck);
+
+        gpuCullingCheck = new QCheckBox("GPU culling", this);
+        gpuCullingCheck->setChecked(true);
+        layout->addWidget(gpuCullingCheck);
+
+        // Culled clusters are drawn from the commands written on GPU, which
+        // are always drawn indirectly.
+        indirectDrawCheck->setEnabled(!gpuCullingCheck->isChecked());
+        indirectDrawCheck->setToolTip("Draws all the segments by one glMultiDrawElementsIndirect.\n"
+                                      "Disabled with GPU culling, which always draws indirectly.");
+
+        depthPrepassCheck = new QCheckBox("Depth pre-pass", this);
+        depthPrepassCheck->setChecked(false);
+        layout->addWidget(depthPrepassCheck);
+
+        tiledResolveCheck = new QCheckBox("Tiled resolve", this);
+        tiledResolveCheck->setChecked(true);
+        layout->addWidget(tiledResolveCheck);
+
+        edgeListResolveCheck = new QCheckBox("Edge-list resolve", this);
+        edgeListResolveCheck->setChecked(false);
+        layout->addWidget(edgeListResolveCheck);
+
+        benchmarkButton = new QPushButton("Benchmark resolve", this);
+        layout->addWidget(benchmarkButton);
     }
 
     virtual ~Ui() {
@@ -39,6 +69,12 @@ public:
     QLabel *subsampleLabel;
     QLineEdit *subsampleEdit;
     QPushButton *updateButton;
+    QCheckBox *indirectDrawCheck;
+    QCheckBox *gpuCullingCheck;
+    QCheckBox *depthPrepassCheck;
+    QCheckBox *tiledResolveCheck;
+    QCheckBox *edgeListResolveCheck;
+    QPushButton *benchmarkButton;
 
 private:
     QVBoxLayout *layout;
@@ -63,6 +99,12 @@ MainGui::MainGui(QWidget *parent)
 
     connect(viewer, SIGNAL(frameSwapped()), this, SLOT(onFrameSwapped()));
     connect(ui->updateButton, SIGNAL(clicked()), this, SLOT(onUpdateButtonClicked()));
+    connect(ui->indirectDrawCheck, SIGNAL(toggled(bool)), this, SLOT(onIndirectDrawToggled(bool)));
+    connect(ui->gpuCullingCheck, SIGNAL(toggled(bool)), this, SLOT(onGpuCullingToggled(bool)));
+    connect(ui->depthPrepassCheck, SIGNAL(toggled(bool)), this, SLOT(onDepthPrepassToggled(bool)));
+    connect(ui->tiledResolveCheck, SIGNAL(toggled(bool)), this, SLOT(onTiledResolveToggled(bool)));
+    connect(ui->edgeListResolveCheck, SIGNAL(toggled(bool)), this, SLOT(onEdgeListResolveToggled(bool)));
+    connect(ui->benchmarkButton, SIGNAL(clicked()), this, SLOT(onBenchmarkButtonClicked()));
 }
 
 MainGui::~MainGui() {
@@ -79,7 +121,11 @@ void MainGui::onFrameSwapped() {
     } else if (timer.elapsed() > 500) {
         long long currentTime = timer.elapsed();
         double fps = 1000.0 / (currentTime - lastTime);
-        setWindowTitle(QString("FPS: %1").arg(QString::number(fps, 'f', 2)));
+        setWindowTitle(QString("FPS: %1, CPU: %2 ms, Pre-pass: %3 ms, G-buffer: %4 ms")
+                       .arg(QString::number(fps, 'f', 2))
+                       .arg(QString::number(viewer->cpuFrameTime(), 'f', 3))
+                       .arg(QString::number(viewer->prepassTime(), 'f', 3))
+                       .arg(QString::number(viewer->gbufferTime(), 'f', 3)));
         
         timer.restart();
     }
@@ -90,3 +136,28 @@ void MainGui::onUpdateButtonClicked() {
     viewer->setAAMethod(ui->aaTypeRadios->selectedIndex(),
                         ui->subsampleEdit->text().toInt());
 }
+
+void MainGui::onIndirectDrawToggled(bool checked) {
+    viewer->setIndirectDraw(checked);
+}
+
+void MainGui::onGpuCullingToggled(bool checked) {
+    viewer->setGpuCulling(checked);
+    ui->indirectDrawCheck->setEnabled(!checked);
+}
+
+void MainGui::onDepthPrepassToggled(bool checked) {
+    viewer->setDepthPrepass(checked);
+}
+
+void MainGui::onTiledResolveToggled(bool checked) {
+    viewer->setTiledResolve(checked);
+}
+
+void MainGui::onEdgeListResolveToggled(bool checked) {
+    viewer->setEdgeListResolve(checked);
+}
+
+void MainGui::onBenchmarkButtonClicked() {
+    viewer->benchmarkResolve();
+}
@@ -21,6 +21,12 @@ public:
 private slots:
     void onFrameSwapped();
     void onUpdateButtonClicked();
+    void onIndirectDrawToggled(bool checked);
+    void onGpuCullingToggled(bool checked);
+    void onDepthPrepassToggled(bool checked);
+    void onTiledResolveToggled(bool checked);
+    void onEdgeListResolveToggled(bool checked);
+    void onBenchmarkButtonClicked();
 
 private:
     QWidget *mainWidget = nullptr;
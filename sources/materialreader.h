@@ -0,0 +1,65 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _MATERIALREADER_H_
+#define _MATERIALREADER_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "textureloader.h"
+#include "tiny_obj_loader.h"
+
+/**
+ * Material reader of the viewer.
+ * @details
+ * Reads .mtl files like tinyobj::MaterialFileReader, remembers their paths
+ * and requests the textures of the new materials to TextureLoader, so they
+ * are decoded while the rest of the OBJ file is parsed.
+ **/
+class SceneMaterialReader : public tinyobj::MaterialReader {
+public:
+    SceneMaterialReader(const std::string &basePath, TextureLoader *textureLoader = nullptr)
+        : basePath_(basePath)
+        , reader_(basePath)
+        , textureLoader_(textureLoader) {
+    }
+
+    bool operator()(const std::string &matId,
+                    std::vector<tinyobj::material_t> &materials,
+                    std::map<std::string, int> &matMap,
+                    std::string &err) override {
+        files_.push_back(basePath_ + matId);
+
+        const size_t first = materials.size();
+        bool success = reader_(matId, materials, matMap, err);
+        if (textureLoader_) {
+            for (size_t i = first; i < materials.size(); i++) {
+                request(materials[i].diffuse_texname);
+                request(materials[i].specular_texname);
+            }
+        }
+        return success;
+    }
+
+    //! Paths of the .mtl files read so far.
+    const std::vector<std::string> & files() const {
+        return files_;
+    }
+
+private:
+    void request(const std::string &texname) {
+        if (!texname.empty()) {
+            textureLoader_->request(basePath_ + texname);
+        }
+    }
+
+    std::string basePath_;
+    tinyobj::MaterialFileReader reader_;
+    TextureLoader *textureLoader_;
+    std::vector<std::string> files_;
+};
+
+#endif  // _MATERIALREADER_H_
@@ -0,0 +1,289 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _MATERIALTABLE_H_
+#define _MATERIALTABLE_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <QtCore/qbytearray.h>
+#include <QtGui/qimage.h>
+#include <QtGui/qvector3d.h>
+#include <QtGui/qopenglextrafunctions.h>
+
+#include "glutils.h"
+#include "imagetexture.h"
+
+struct MaterialInfo {
+    QVector3D diffuse = { 1.0f, 1.0f, 1.0f };
+    QVector3D specular = { 0.0f, 0.0f, 0.0f };
+    QVector3D ambient = { 0.0f, 0.0f, 0.0f };
+    float shininess = 1.0f;
+    std::shared_ptr<ImageTexture> diffuse_texture = nullptr;
+    std::shared_ptr<ImageTexture> specular_texture = nullptr;
+    std::shared_ptr<ImageTexture> bump_texture = nullptr;
+};
+
+//! Bits of the shader permutation drawing a material. Bit i is defined by
+//! the i-th name of kMaterialFeatureNames in gbuffer.fs and render.fs.
+enum MaterialFeature : uint32_t {
+    kDiffuseTexture = 1 << 0,
+    kSpecularTexture = 1 << 1,
+};
+
+static const std::vector<QByteArray> kMaterialFeatureNames = { "HAS_DIFFUSE_TEX", "HAS_SPECULAR_TEX" };
+
+//! Features of `material`, which match the textures MaterialTable uploads.
+inline uint32_t materialFeatures(const MaterialInfo &material) {
+    auto hasImage = [](const std::shared_ptr<ImageTexture> &texture) {
+        return texture && texture->hasImage();
+    };
+
+    uint32_t features = 0;
+    if (hasImage(material.diffuse_texture)) features |= kDiffuseTexture;
+    if (hasImage(material.specular_texture)) features |= kSpecularTexture;
+    return features;
+}
+
+struct SegmentInfo {
+    int start;
+    int count;
+    MaterialInfo material;
+};
+
+/**
+ * Materials of all the segments on GPU.
+ * @details
+ * Material i is the one of segment i, stored as `Material` in the shader
+ * storage block at binding kStorageBinding. Textures are copied to texture
+ * arrays, one for each image size, bound from unit kFirstTextureUnit.
+ * A texture is referred to as (array << 16 | layer), or -1 if there is none.
+ * When the images have more than kMaxTextureArrays sizes, the images of rare
+ * sizes are scaled to the closest size in use.
+ * The arrays are the only copy of the textures. Host images are released
+ * once uploaded, and an array grows by copying its layers on GPU. Bump maps
+ * are not uploaded, as no shader samples them.
+ **/
+class MaterialTable : protected QOpenGLExtraFunctions {
+public:
+    static constexpr int kMaxTextureArrays = 8;
+    static constexpr int kFirstTextureUnit = 10;
+    static constexpr int kStorageBinding = 0;
+
+    MaterialTable() {
+        initializeOpenGLFunctions();
+        glGenBuffers(1, &ssbo_);
+    }
+
+    MaterialTable(const MaterialTable &) = delete;
+    MaterialTable & operator=(const MaterialTable &) = delete;
+
+    virtual ~MaterialTable() {
+        releaseArrays();
+        glDeleteBuffers(1, &ssbo_);
+    }
+
+    //! Uploads the materials of `segments`. Textures added since the last
+    //! call are appended to the arrays.
+    void update(const std::vector<SegmentInfo> &segments) {
+        std::vector<ImageTexture*> newTextures;
+        for (const auto &seg : segments) {
+            for (const auto *tex : { &seg.material.diffuse_texture, &seg.material.specular_texture }) {
+                if (*tex && (*tex)->hasImage() && slots_.count(tex->get()) == 0) {
+                    slots_[tex->get()] = -1;
+                    newTextures.push_back(tex->get());
+                }
+            }
+        }
+        if (!newTextures.empty()) {
+            addTextures(newTextures);
+        }
+
+        std::vector<Record> records(segments.size());
+        for (size_t i = 0; i < segments.size(); i++) {
+            const auto &m = segments[i].material;
+            Record &r = records[i];
+            r.diffuse[0] = m.diffuse.x();
+            r.diffuse[1] = m.diffuse.y();
+            r.diffuse[2] = m.diffuse.z();
+            r.diffuse[3] = m.shininess;
+            r.specular[0] = m.specular.x();
+            r.specular[1] = m.specular.y();
+            r.specular[2] = m.specular.z();
+            r.specular[3] = 0.0f;
+            r.textures[0] = slot(m.diffuse_texture);
+            r.textures[1] = slot(m.specular_texture);
+            r.textures[2] = -1;
+            r.textures[3] = -1;
+        }
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(records.size(), (size_t)1) * sizeof(Record),
+                     records.empty() ? nullptr : records.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        numMaterials_ = segments.size();
+    }
+
+    size_t size() const {
+        return numMaterials_;
+    }
+
+    void bind() {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kStorageBinding, ssbo_);
+        for (int i = 0; i < (int)arrays_.size(); i++) {
+            glActiveTexture(GL_TEXTURE0 + kFirstTextureUnit + i);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, arrays_[i].id);
+        }
+    }
+
+    void release() {
+        for (int i = 0; i < (int)arrays_.size(); i++) {
+            glActiveTexture(GL_TEXTURE0 + kFirstTextureUnit + i);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        }
+        glActiveTexture(GL_TEXTURE0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kStorageBinding, 0);
+    }
+
+private:
+    //! Layout of `Material` in the shaders (std430).
+    struct Record {
+        float diffuse[4];   //! Shininess in w.
+        float specular[4];
+        int32_t textures[4];
+    };
+
+    int32_t slot(const std::shared_ptr<ImageTexture> &texture) const {
+        if (!texture) {
+            return -1;
+        }
+        auto it = slots_.find(texture.get());
+        return it != slots_.end() ? it->second : -1;
+    }
+
+    struct TextureArray {
+        GLuint id = 0;
+        int width = 0;
+        int height = 0;
+        int layers = 0;
+    };
+
+    void addTextures(const std::vector<ImageTexture*> &textures) {
+        // Images grouped by size, the most common sizes first.
+        std::map<std::pair<int, int>, std::vector<ImageTexture*>> groups;
+        for (auto *texture : textures) {
+            const QImage &image = texture->image();
+            groups[std::make_pair(image.width(), image.height())].push_back(texture);
+        }
+        std::vector<std::pair<std::pair<int, int>, std::vector<ImageTexture*>>> sorted(groups.begin(), groups.end());
+        std::stable_sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+            return a.second.size() > b.second.size();
+        });
+
+        std::vector<std::vector<ImageTexture*>> added(arrays_.size());
+        for (const auto &group : sorted) {
+            const int width = group.first.first;
+            const int height = group.first.second;
+
+            int target = -1;
+            for (int a = 0; a < (int)arrays_.size(); a++) {
+                if (arrays_[a].width == width && arrays_[a].height == height) {
+                    target = a;
+                }
+            }
+            if (target < 0 && (int)arrays_.size() < kMaxTextureArrays) {
+                TextureArray array;
+                array.width = width;
+                array.height = height;
+                arrays_.push_back(array);
+                added.emplace_back();
+                target = (int)arrays_.size() - 1;
+            }
+            if (target < 0) {
+                // Rare size, scaled to the closest one.
+                const int64_t area = (int64_t)width * height;
+                target = 0;
+                for (int a = 1; a < (int)arrays_.size(); a++) {
+                    if (std::abs((int64_t)arrays_[a].width * arrays_[a].height - area) <
+                        std::abs((int64_t)arrays_[target].width * arrays_[target].height - area)) {
+                        target = a;
+                    }
+                }
+            }
+            added[target].insert(added[target].end(), group.second.begin(), group.second.end());
+        }
+
+        for (int a = 0; a < (int)arrays_.size(); a++) {
+            if (!added[a].empty()) {
+                growArray(a, added[a]);
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    //! Appends `textures` to array `a` and releases their host images.
+    void growArray(int a, const std::vector<ImageTexture*> &textures) {
+        static const auto copyImageSubData =
+            glProcAddress<GLCopyImageSubDataProc>("glCopyImageSubData", 4, 3);
+
+        TextureArray &array = arrays_[a];
+        const int layers = array.layers + (int)textures.size();
+
+        GLuint grown = 0;
+        glGenTextures(1, &grown);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, grown);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, array.width, array.height, layers);
+        if (array.id) {
+            if (copyImageSubData) {
+                copyImageSubData(array.id, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+                                 grown, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+                                 array.width, array.height, array.layers);
+            } else {
+                printf("[WARNING] glCopyImageSubData is not supported.\n");
+            }
+            glDeleteTextures(1, &array.id);
+        }
+
+        for (int i = 0; i < (int)textures.size(); i++) {
+            const int layer = array.layers + i;
+            QImage image = textures[i]->image();
+            if (image.width() != array.width || image.height() != array.height) {
+                image = image.scaled(array.width, array.height, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+            }
+            // Flipped as ImageTexture does.
+            image = image.convertToFormat(QImage::Format_RGBA8888).mirrored();
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, array.width, array.height, 1,
+                            GL_RGBA, GL_UNSIGNED_BYTE, image.constBits());
+            slots_[textures[i]] = (a << 16) | layer;
+            textures[i]->releaseImage();
+        }
+
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        array.id = grown;
+        array.layers = layers;
+    }
+
+    void releaseArrays() {
+        for (auto &array : arrays_) {
+            glDeleteTextures(1, &array.id);
+        }
+        arrays_.clear();
+    }
+
+    GLuint ssbo_ = 0;
+    std::vector<TextureArray> arrays_;
+    std::map<const ImageTexture*, int32_t> slots_;
+    size_t numMaterials_ = 0;
+};
+
+#endif  // _MATERIALTABLE_H_
@@ -0,0 +1,286 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _MESHOPTIMIZER_H_
+#define _MESHOPTIMIZER_H_
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+
+/**
+ * Triangle and vertex reordering for GPU caches.
+ * @details
+ * -- Usage --
+ * 1) call optimizeVertexCache() for every range of indices drawn at once.
+ * 2) call optimizeVertexFetch() once for the whole index buffer.
+ * Indices refer to a vertex buffer whose attributes are stored one after
+ * another, as VertexArrayObject lays them out.
+ **/
+namespace meshopt {
+
+//! Statistics of a simulated FIFO post-transform vertex cache.
+struct CacheStats {
+    float acmr = 0.0f;  //! Cache misses per triangle.
+    float atvr = 0.0f;  //! Cache misses per referenced vertex, 1 is optimal.
+};
+
+inline CacheStats analyzeVertexCache(const uint32_t *indices, size_t numIndices, int cacheSize = 16) {
+    CacheStats stats;
+    if (numIndices < 3) {
+        return stats;
+    }
+
+    std::vector<uint32_t> fifo;
+    std::vector<uint32_t> vertices(indices, indices + numIndices);
+    std::sort(vertices.begin(), vertices.end());
+    const size_t numUnique = std::unique(vertices.begin(), vertices.end()) - vertices.begin();
+
+    size_t misses = 0;
+    for (size_t i = 0; i < numIndices; i++) {
+        if (std::find(fifo.begin(), fifo.end(), indices[i]) == fifo.end()) {
+            misses++;
+            fifo.push_back(indices[i]);
+            if (fifo.size() > (size_t)cacheSize) {
+                fifo.erase(fifo.begin());
+            }
+        }
+    }
+
+    stats.acmr = (float)misses / (float)(numIndices / 3);
+    stats.atvr = (float)misses / (float)numUnique;
+    return stats;
+}
+
+/**
+ * Reorders the triangles of [indices, indices + numIndices) with Tipsify
+ * [Sander et al. 2007] for a vertex cache of `cacheSize` entries. When
+ * `positions` is given, the clusters Tipsify produces are then sorted so
+ * that triangles facing outwards are drawn first, to reduce overdraw.
+ * `remap` is scratch of one entry per vertex, all -1. It is left so on
+ * return, so one vector can be reused for all the ranges of a buffer.
+ **/
+inline void optimizeVertexCache(uint32_t *indices, size_t numIndices, std::vector<int> &remap,
+                                const float *positions = nullptr, int cacheSize = 16) {
+    const size_t numTris = numIndices / 3;
+    if (numTris == 0) {
+        return;
+    }
+
+    // Vertices are renumbered in the range, so the work is proportional to
+    // the size of the range rather than to the whole vertex buffer.
+    std::vector<uint32_t> globalIds;
+    std::vector<uint32_t> tris(numTris * 3);
+    for (size_t i = 0; i < numTris * 3; i++) {
+        int &id = remap[indices[i]];
+        if (id < 0) {
+            id = (int)globalIds.size();
+            globalIds.push_back(indices[i]);
+        }
+        tris[i] = (uint32_t)id;
+    }
+    const size_t n = globalIds.size();
+    for (uint32_t v : globalIds) {
+        remap[v] = -1;
+    }
+
+    // Triangles adjacent to each vertex.
+    std::vector<int> live(n, 0);
+    for (uint32_t v : tris) {
+        live[v]++;
+    }
+    std::vector<size_t> offsets(n + 1, 0);
+    for (size_t v = 0; v < n; v++) {
+        offsets[v + 1] = offsets[v] + live[v];
+    }
+    std::vector<uint32_t> adjacency(offsets[n]);
+    std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < numTris; t++) {
+        for (int k = 0; k < 3; k++) {
+            adjacency[fill[tris[t * 3 + k]]++] = (uint32_t)t;
+        }
+    }
+
+    std::vector<int> cacheTime(n, 0);
+    std::vector<char> emitted(numTris, 0);
+    std::vector<uint32_t> deadEnd;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> order;
+    std::vector<size_t> clusters(1, 0);
+    order.reserve(numTris);
+
+    int time = cacheSize + 1;
+    size_t cursor = 0;
+    int fanning = 0;
+    while (fanning >= 0) {
+        candidates.clear();
+        for (size_t a = offsets[fanning]; a < offsets[fanning + 1]; a++) {
+            const uint32_t t = adjacency[a];
+            if (emitted[t]) {
+                continue;
+            }
+
+            for (int k = 0; k < 3; k++) {
+                const uint32_t v = tris[t * 3 + k];
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cacheTime[v] > cacheSize) {
+                    cacheTime[v] = time++;
+                }
+            }
+            emitted[t] = 1;
+            order.push_back(t);
+        }
+
+        // Pick the candidate which is still in the cache after fanning it.
+        int next = -1;
+        int best = -1;
+        for (uint32_t v : candidates) {
+            if (live[v] <= 0) {
+                continue;
+            }
+            int priority = 0;
+            if (time - cacheTime[v] + 2 * live[v] <= cacheSize) {
+                priority = time - cacheTime[v];
+            }
+            if (priority > best) {
+                best = priority;
+                next = (int)v;
+            }
+        }
+
+        if (next < 0) {
+            // Dead end. The cache is cold from here, so a cluster starts.
+            while (!deadEnd.empty() && next < 0) {
+                const uint32_t v = deadEnd.back();
+                deadEnd.pop_back();
+                if (live[v] > 0) {
+                    next = (int)v;
+                }
+            }
+            while (next < 0 && cursor < n) {
+                if (live[cursor] > 0) {
+                    next = (int)cursor;
+                }
+                cursor++;
+            }
+            if (order.size() > clusters.back()) {
+                clusters.push_back(order.size());
+            }
+        }
+        fanning = next;
+    }
+    if (clusters.back() != order.size()) {
+        clusters.push_back(order.size());
+    }
+
+    // Draw clusters facing away from the center of the range first.
+    if (positions && clusters.size() > 2) {
+        auto position = [&](uint32_t v, int k) {
+            return positions[globalIds[v] * 3 + k];
+        };
+
+        float center[3] = { 0.0f, 0.0f, 0.0f };
+        for (size_t t = 0; t < numTris; t++) {
+            for (int k = 0; k < 3; k++) {
+                center[k] += (position(tris[t * 3 + 0], k) + position(tris[t * 3 + 1], k) +
+                              position(tris[t * 3 + 2], k)) / (3.0f * numTris);
+            }
+        }
+
+        std::vector<std::pair<float, size_t>> sorted;
+        for (size_t c = 0; c + 1 < clusters.size(); c++) {
+            float centroid[3] = { 0.0f, 0.0f, 0.0f };
+            float normal[3] = { 0.0f, 0.0f, 0.0f };
+            for (size_t i = clusters[c]; i < clusters[c + 1]; i++) {
+                const uint32_t *tri = &tris[order[i] * 3];
+                float e1[3], e2[3];
+                for (int k = 0; k < 3; k++) {
+                    centroid[k] += position(tri[0], k) + position(tri[1], k) + position(tri[2], k);
+                    e1[k] = position(tri[1], k) - position(tri[0], k);
+                    e2[k] = position(tri[2], k) - position(tri[0], k);
+                }
+                // Area-weighted normal.
+                normal[0] += e1[1] * e2[2] - e1[2] * e2[1];
+                normal[1] += e1[2] * e2[0] - e1[0] * e2[2];
+                normal[2] += e1[0] * e2[1] - e1[1] * e2[0];
+            }
+
+            const float count = 3.0f * (clusters[c + 1] - clusters[c]);
+            const float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+            float dot = 0.0f;
+            for (int k = 0; k < 3; k++) {
+                dot += (centroid[k] / count - center[k]) * (length > 0.0f ? normal[k] / length : 0.0f);
+            }
+            sorted.emplace_back(-dot, c);
+        }
+        std::stable_sort(sorted.begin(), sorted.end());
+
+        std::vector<uint32_t> reordered;
+        reordered.reserve(numTris);
+        for (const auto &s : sorted) {
+            reordered.insert(reordered.end(), order.begin() + clusters[s.second],
+                             order.begin() + clusters[s.second + 1]);
+        }
+        order.swap(reordered);
+    }
+
+    for (size_t i = 0; i < numTris; i++) {
+        for (int k = 0; k < 3; k++) {
+            indices[i * 3 + k] = globalIds[tris[order[i] * 3 + k]];
+        }
+    }
+}
+
+//! Same as above with scratch for a buffer of `numVertices` vertices.
+inline void optimizeVertexCache(uint32_t *indices, size_t numIndices, size_t numVertices,
+                                const float *positions = nullptr, int cacheSize = 16) {
+    std::vector<int> remap(numVertices, -1);
+    optimizeVertexCache(indices, numIndices, remap, positions, cacheSize);
+}
+
+/**
+ * Reorders vertices in the order they are first referenced by `indices`, so
+ * vertex fetches are close in memory, and rewrites `indices` to match.
+ * Each of `attribs` holds `tupleSizes[i]` floats per vertex and is reordered
+ * in place. Unreferenced vertices are moved to the end.
+ * Returns the number of referenced vertices.
+ **/
+inline size_t optimizeVertexFetch(const std::vector<float*> &attribs, const std::vector<int> &tupleSizes,
+                                  size_t numVertices, uint32_t *indices, size_t numIndices) {
+    std::vector<uint32_t> remap(numVertices, UINT32_MAX);
+    uint32_t count = 0;
+    for (size_t i = 0; i < numIndices; i++) {
+        uint32_t &id = remap[indices[i]];
+        if (id == UINT32_MAX) {
+            id = count++;
+        }
+        indices[i] = id;
+    }
+
+    uint32_t unused = count;
+    for (size_t v = 0; v < numVertices; v++) {
+        if (remap[v] == UINT32_MAX) {
+            remap[v] = unused++;
+        }
+    }
+
+    std::vector<float> temp;
+    for (size_t a = 0; a < attribs.size(); a++) {
+        const int tupleSize = tupleSizes[a];
+        temp.assign(attribs[a], attribs[a] + numVertices * tupleSize);
+        for (size_t v = 0; v < numVertices; v++) {
+            std::copy(&temp[v * tupleSize], &temp[v * tupleSize] + tupleSize,
+                      attribs[a] + remap[v] * tupleSize);
+        }
+    }
+
+    return count;
+}
+
+}  // namespace meshopt
+
+#endif  // _MESHOPTIMIZER_H_
@@ -1,13 +1,23 @@
 #include "openglviewer.h"
 
+#include <algorithm>
 #include <vector>
 
 #include <QtCore/qdir.h>
+#include <QtCore/qelapsedtimer.h>
 #include <QtCore/qfileinfo.h>
 #include <QtGui/qopenglextrafunctions.h>
+#include <QtGui/qopengltimemonitor.h>
 
 #include "common.h"
+#include "edgelist.h"
 #include "glutils.h"
+#include "materialreader.h"
+#include "meshoptimizer.h"
+#include "scenecache.h"
+#include "sceneculler.h"
+#include "scenestream.h"
+#include "textureregistry.h"
 #include "tiny_obj_loader.h"
 
 static constexpr float cameraFov = 30.0f;
@@ -20,9 +30,31 @@ static const QVector3D eyeUp = QVector3D(0.0f, 1.0f, 0.0f);
 
 static const QVector3D lightPos = QVector3D(0.0f, 10.0f, 0.0f);
 
+// OBJ files at least this large are streamed while parsing.
+static constexpr qint64 streamingFileSize = 256 << 20;
+
+// Reorder imported meshes for the vertex cache before they are cached.
+static constexpr bool optimizeSceneMeshes = true;
+
+// Store scene positions as 16-bit integers within the bounds of the scene.
+static constexpr bool quantizeScenePositions = true;
+
+// Free the host copies of scene vertices and indices once they are on GPU.
+static constexpr bool releaseSceneHostData = true;
+
+// Tiles of the shared-memory resolve in msaa.cs, in pixels, and the largest
+// subsample whose tiles it holds.
+static constexpr int resolveTileSize = 8;
+static constexpr int resolveMaxSubsample = 4;
+
+// Workgroup size of the passes of the edge-list resolve in msaa.cs.
+static constexpr int edgeListLocalSize = 64;
+
 OpenGLViewer::OpenGLViewer(QWidget *parent)
     : QOpenGLWidget(parent) {
     camera = std::make_unique<ArcballCamera>(this);
+    textureLoader = std::make_unique<TextureLoader>();
+    textureRegistry = std::make_unique<TextureRegistry>(*textureLoader);
     timer = new QTimer(this);
     timer->start();
     connect(timer, SIGNAL(timeout()), this, SLOT(onAnimate()));
@@ -31,15 +63,97 @@ OpenGLViewer::OpenGLViewer(QWidget *parent)
 OpenGLViewer::~OpenGLViewer() {
 }
 
+namespace {
+
+int32_t addTexturePath(std::vector<std::string> &paths, const std::string &path) {
+    if (path.empty()) {
+        return -1;
+    }
+
+    auto it = std::find(paths.begin(), paths.end(), path);
+    if (it != paths.end()) {
+        return (int32_t)(it - paths.begin());
+    }
+    paths.push_back(path);
+    return (int32_t)paths.size() - 1;
+}
+
+//! Must be called on the context thread.
+std::shared_ptr<ImageTexture> loadTexture(TextureRegistry &registry, const std::string &dirname,
+                                          const std::string &texname) {
+    if (texname.empty()) {
+        return nullptr;
+    }
+
+    bool decoded = false;
+    auto texture = registry.get(dirname + texname, &decoded);
+    if (!decoded) {
+        WarnMsg("Failed to load image file: %s", texname.c_str());
+    }
+    return texture;
+}
+
+void printTextureStats(const TextureRegistry::Stats &stats) {
+    printf("[INFO] textures: %d uploaded (%.1f MB), %d shared (%.1f MB saved)\n",
+           stats.uploads, stats.bytes / (1024.0 * 1024.0),
+           stats.hits, stats.bytesSaved / (1024.0 * 1024.0));
+}
+
+void printMemoryStats(const char *name, const VertexMemoryStats &stats) {
+    printf("[INFO] %s vertices: %.1f MB on host, %.1f MB on GPU\n", name,
+           stats.hostBytes / (1024.0 * 1024.0), stats.gpuBytes / (1024.0 * 1024.0));
+}
+
+}  // anonymous namespace
+
 void OpenGLViewer::load(const std::string &filename) {
     QFileInfo fileinfo(filename.c_str());
     std::string dirname = (fileinfo.absoluteDir().absolutePath() + "/").toStdString();
+    const std::string cachename = filename + ".cache";
 
     makeCurrent();
+
+    // Stop the import of the previous scene, if any.
+    sceneStream = nullptr;
+    sceneDirname = dirname;
+    textureRegistry->clear();
+
+    // Upload straight from the binary cache when it is up to date.
+    SceneCache cache;
+    if (cache.open(cachename)) {
+        const SceneBuffers &buffers = cache.buffers();
+        sceneVao = std::make_unique<VertexArrayObject>();
+        sceneVao->addVertexAttrib(buffers.positions, buffers.numVertices * 3, 0, 3);
+        sceneVao->addVertexAttrib(buffers.normals, buffers.numVertices * 3, 1, 3);
+        sceneVao->addVertexAttrib(buffers.texcoords, buffers.numVertices * 2, 2, 2);
+        sceneVao->addIndices(buffers.indices, buffers.numIndices);
+        setScene(buffers, dirname);
+    } else if (fileinfo.size() >= streamingFileSize) {
+        // Large scenes are displayed while parsing. They are not cached,
+        // since the whole scene is never held in memory.
+        startStreaming(filename, dirname);
+    } else {
+        importScene(filename, dirname, cachename);
+    }
+
+    // Initialize VAO for screen rectangle.
+    squareVao = std::unique_ptr<VertexArrayObject>(VertexArrayObject::asSquare());
+
+    // Initialize arcball controller
+    camera->setLookAt(eyePos, eyeTo, eyeUp);
+    camera->setPerspective(cameraFov, (float)width() / (float)height(), cameraNearClip, cameraFarClip);
+}
+
+void OpenGLViewer::importScene(const std::string &filename, const std::string &dirname,
+                               const std::string &cachename) {
+    QFileInfo fileinfo(filename.c_str());
+
     std::vector<tinyobj::shape_t> shapes;
     std::vector<tinyobj::material_t> materials;
     std::string errmsg;
-    bool success = tinyobj::LoadObj(shapes, materials, errmsg, filename.c_str(), dirname.c_str());
+    SceneMaterialReader matReader(dirname, textureLoader.get());
+    bool success = tinyobj::LoadObj(shapes, materials, errmsg, filename.c_str(), matReader,
+                                    tinyobj::triangulation | tinyobj::parallel_parsing);
     if (!errmsg.empty()) {
         WarnMsg("%s\n", errmsg.c_str());
     }
@@ -48,50 +162,58 @@ void OpenGLViewer::load(const std::string &filename) {
         ErrorMsg("Failed to load file: %s", filename.c_str());
     }
     
-    // Set vertex arrays.
-    using Face = std::tuple<int, int, int, int>;
-    std::vector<float> tempPos;
-    std::vector<float> tempNorm;
-    std::vector<float> tempUv;
-    std::vector<Face> tempFace;     
+    // Set vertex arrays. Positions, normals and texcoords are stored one
+    // after another, as VertexArrayObject lays them out in the vertex buffer.
+    size_t numVertices = 0;
+    size_t numFaces = 0;
+    for (const auto &shape : shapes) {
+        numVertices += shape.mesh.positions.size() / 3;
+        numFaces += shape.mesh.material_ids.size();
+    }
+
+    std::vector<float> vertices(numVertices * 8, 0.0f);
+    float *positions = vertices.data();
+    float *normals = positions + numVertices * 3;
+    float *texcoords = normals + numVertices * 3;
+
+    // Vertices shared by triangles stay shared. Only the triangles are sorted
+    // by material, and their indices are offset to the vertices of the shape.
+    using Face = std::tuple<int, uint32_t, uint32_t, uint32_t>;
+    std::vector<Face> tempFace;
+    tempFace.reserve(numFaces);
+
+    size_t base = 0;
     for (const auto &shape : shapes) {
         const auto &mesh = shape.mesh;
-        tempPos.insert(tempPos.end(), mesh.positions.begin(), mesh.positions.end());
-        tempNorm.insert(tempNorm.end(), mesh.normals.begin(), mesh.normals.end());
-        tempUv.insert(tempUv.end(), mesh.texcoords.begin(), mesh.texcoords.end());
+        const size_t n = mesh.positions.size() / 3;
+        std::copy(mesh.positions.begin(), mesh.positions.begin() + n * 3, positions + base * 3);
+        std::copy(mesh.normals.begin(), mesh.normals.begin() + std::min(n * 3, mesh.normals.size()),
+                  normals + base * 3);
+        std::copy(mesh.texcoords.begin(), mesh.texcoords.begin() + std::min(n * 2, mesh.texcoords.size()),
+                  texcoords + base * 2);
+
         for (int i = 0; i < mesh.material_ids.size(); i++) {
             Face f;
             std::get<0>(f) = mesh.material_ids[i];
-            std::get<1>(f) = mesh.indices[i * 3 + 0];
-            std::get<2>(f) = mesh.indices[i * 3 + 1];
-            std::get<3>(f) = mesh.indices[i * 3 + 2];
+            std::get<1>(f) = (uint32_t)(base + mesh.indices[i * 3 + 0]);
+            std::get<2>(f) = (uint32_t)(base + mesh.indices[i * 3 + 1]);
+            std::get<3>(f) = (uint32_t)(base + mesh.indices[i * 3 + 2]);
             tempFace.push_back(f);
         }
+        base += n;
     }
     std::sort(tempFace.begin(), tempFace.end());
 
-    std::vector<float> positions;
-    std::vector<float> normals;
-    std::vector<float> texcoords;
     std::vector<uint32_t> indices;
     std::vector<int> border(materials.size(), -1);
+    indices.reserve(tempFace.size() * 3);
 
-    int count = 0;
     int mtrl_count = 0;
     for (int i = 0; i < tempFace.size(); i++) {
         const auto &f = tempFace[i];
-        int idx[3] = { std::get<1>(f), std::get<2>(f), std::get<3>(f) };
-        for (int j = 0; j < 3; j++) {
-            positions.push_back(tempPos[idx[j] * 3 + 0]);    
-            positions.push_back(tempPos[idx[j] * 3 + 1]);    
-            positions.push_back(tempPos[idx[j] * 3 + 2]);
-            normals.push_back(tempNorm[idx[j] * 3 + 0]);
-            normals.push_back(tempNorm[idx[j] * 3 + 1]);
-            normals.push_back(tempNorm[idx[j] * 3 + 2]);
-            texcoords.push_back(tempUv[idx[j] * 2 + 0]);
-            texcoords.push_back(tempUv[idx[j] * 2 + 1]);
-            indices.push_back(count++);
-        }
+        indices.push_back(std::get<1>(f));
+        indices.push_back(std::get<2>(f));
+        indices.push_back(std::get<3>(f));
 
         int matId = std::get<0>(f);
         while (mtrl_count < materials.size() && border[mtrl_count] == -1 && mtrl_count <= matId) {
@@ -99,64 +221,184 @@ void OpenGLViewer::load(const std::string &filename) {
             mtrl_count += 1;
         }
     }
+
+    // Borders are set in order, so unset ones are of the materials after the
+    // last one used. Their segments are empty.
+    for (auto &b : border) {
+        if (b < 0) b = (int)indices.size();
+    }
     border.push_back(indices.size());
 
-    // Initialize VAO (Scene).
-    sceneVao = std::make_unique<VertexArrayObject>();
-    sceneVao->addVertexAttrib(positions, 0, 3);
-    sceneVao->addVertexAttrib(normals, 1, 3);
-    sceneVao->addVertexAttrib(texcoords, 2, 2);
-    sceneVao->addIndices(indices);
+    if (optimizeSceneMeshes) {
+        // Reorder triangles of each segment for the post-transform cache,
+        // then vertices in the order they are fetched.
+        std::vector<int> remap(numVertices, -1);
+        for (int i = 0; i < materials.size(); i++) {
+            if (border[i + 1] <= border[i]) {
+                continue;
+            }
 
-    std::vector<MaterialInfo> matInfo;
+            uint32_t *first = &indices[border[i]];
+            const size_t count = border[i + 1] - border[i];
+            const auto before = meshopt::analyzeVertexCache(first, count);
+            meshopt::optimizeVertexCache(first, count, remap, positions);
+            const auto after = meshopt::analyzeVertexCache(first, count);
+            printf("[INFO] segment %d (%s): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+                   i, materials[i].name.c_str(), before.acmr, after.acmr, before.atvr, after.atvr);
+        }
+        numVertices = meshopt::optimizeVertexFetch({ positions, normals, texcoords }, { 3, 3, 2 },
+                                                   numVertices, indices.data(), indices.size());
+    }
+
+    SceneBuffers buffers;
+    buffers.positions = positions;
+    buffers.normals = normals;
+    buffers.texcoords = texcoords;
+    buffers.numVertices = (uint32_t)numVertices;
+    buffers.indices = indices.data();
+    buffers.numIndices = (uint32_t)indices.size();
     for (int i = 0; i < materials.size(); i++) {
         const auto &m = materials[i];
 
-        MaterialInfo material;        
-        material.diffuse = QVector3D(m.diffuse[0], m.diffuse[1], m.diffuse[2]);
-        material.specular = QVector3D(m.specular[0], m.specular[1], m.specular[2]);
-        material.shininess = m.shininess;
-        
-        if (!m.diffuse_texname.empty()) {
-            QImage img;
-            if(!img.load((dirname + m.diffuse_texname).c_str())) {
-                WarnMsg("Failed to load image file: %s", m.diffuse_texname.c_str());
-            }
-            material.diffuse_texture = std::make_shared<ImageTexture>(img);
+        SceneSegment segment;
+        segment.start = border[i];
+        segment.count = border[i + 1] - border[i];
+        for (int k = 0; k < 3; k++) {
+            segment.diffuse[k] = m.diffuse[k];
+            segment.specular[k] = m.specular[k];
         }
-        
-        if (!m.specular_texname.empty()) {
-            QImage img;
-            if (!img.load((dirname + m.specular_texname).c_str())) {
-                WarnMsg("Failed to load image file: %s", m.specular_texname.c_str());
-            }
-            material.specular_texture = std::make_shared<ImageTexture>(img);
+        segment.shininess = m.shininess;
+        segment.diffuseTex = addTexturePath(buffers.texturePaths, m.diffuse_texname);
+        segment.specularTex = addTexturePath(buffers.texturePaths, m.specular_texname);
+        segment.bumpTex = addTexturePath(buffers.texturePaths, m.bump_texname);
+        buffers.segments.push_back(segment);
+    }
+
+    if (success) {
+        std::vector<std::string> sources = matReader.files();
+        sources.insert(sources.begin(), fileinfo.absoluteFilePath().toStdString());
+        if (!SceneCache::write(cachename, sources, buffers)) {
+            WarnMsg("Failed to write scene cache: %s", cachename.c_str());
         }
+    }
 
-        if (!m.bump_texname.empty()) {
-            QImage img;
-            if (!img.load((dirname + m.bump_texname).c_str())) {
-                WarnMsg("Failed to load image file: %s", m.bump_texname.c_str());
+    // The buffers are moved, so the scene is not copied once more. Blocks
+    // keep their offsets, as unused vertices are only moved to the end.
+    sceneVao = std::make_unique<VertexArrayObject>();
+    sceneVao->addVertexAttribs(std::move(vertices), { { 0, 3 }, { 1, 3 }, { 2, 2 } });
+    sceneVao->addIndices(std::move(indices));
+    setScene(buffers, dirname);
+}
+
+// Uploads the vertices added to sceneVao with the materials of `buffers`.
+void OpenGLViewer::setScene(const SceneBuffers &buffers, const std::string &dirname) {
+    // 8 or 12 bytes for positions, 4 for normals and 4 for texcoords,
+    // instead of 32 bytes per vertex.
+    VertexLayout layout;
+    layout.add(0, 3, quantizeScenePositions ? VertexFormat::UNorm16 : VertexFormat::Float)
+          .add(1, 3, VertexFormat::SNorm10_10_10_2)
+          .add(2, 2, VertexFormat::Half);
+    sceneVao->setLayout(layout);
+    sceneVao->setDepthStream(0);
+
+    auto texturePath = [&](int32_t texId) -> std::string {
+        return texId >= 0 ? buffers.texturePaths[texId] : std::string();
+    };
+
+    // Decode textures while vertices are uploaded. Bump maps are not
+    // loaded, as no shader samples them.
+    for (const auto &seg : buffers.segments) {
+        for (int32_t texId : { seg.diffuseTex, seg.specularTex }) {
+            if (texId >= 0) {
+                textureLoader->request(dirname + texturePath(texId));
             }
-            material.bump_texture = std::make_shared<ImageTexture>(img);
         }
+    }
 
-        matInfo.push_back(material);
+    std::vector<uint32_t> features;
+    for (const auto &seg : buffers.segments) {
+        MaterialInfo material;        
+        material.diffuse = QVector3D(seg.diffuse[0], seg.diffuse[1], seg.diffuse[2]);
+        material.specular = QVector3D(seg.specular[0], seg.specular[1], seg.specular[2]);
+        material.shininess = seg.shininess;
+        material.diffuse_texture = loadTexture(*textureRegistry, dirname, texturePath(seg.diffuseTex));
+        material.specular_texture = loadTexture(*textureRegistry, dirname, texturePath(seg.specularTex));
 
         SegmentInfo segment;
-        segment.start = border[i];
-        segment.count = border[i + 1] - border[i];
+        segment.start = seg.start;
+        segment.count = seg.count;
         segment.material = material;
         sceneVao->addSegment(segment);
+        features.push_back(materialFeatures(material));
     }
-    sceneVao->setReady();
 
-    // Initialize VAO for screen rectangle.
-    squareVao = std::unique_ptr<VertexArrayObject>(VertexArrayObject::asSquare());
+    // Clusters are bounded while the vertices are still on host, and
+    // grouped by the shader permutations of their materials.
+    std::vector<std::pair<int, int>> ranges;
+    for (const auto &seg : buffers.segments) {
+        ranges.emplace_back(seg.start, seg.count);
+    }
+    sceneCuller = std::make_unique<SceneCuller>();
+    sceneCuller->setClusters(buffers.positions, buffers.indices, ranges, features);
+    printf("[INFO] %d clusters for culling\n", (int)sceneCuller->numClusters());
 
-    // Initialize arcball controller
-    camera->setLookAt(eyePos, eyeTo, eyeUp);
-    camera->setPerspective(cameraFov, (float)width() / (float)height(), cameraNearClip, cameraFarClip);
+    sceneVao->setReady(releaseSceneHostData);
+
+    textureLoader->clear();
+    printTextureStats(textureRegistry->stats());
+    printMemoryStats("scene", sceneVao->memoryStats());
+}
+
+void OpenGLViewer::startStreaming(const std::string &filename, const std::string &dirname) {
+    // Streamed scenes have no clusters, and draw every segment.
+    sceneCuller = nullptr;
+    sceneVao = std::make_unique<VertexArrayObject>();
+    sceneVao->beginStream({ 3, 3, 2 }, 1 << 20, 1 << 20);
+    streamMaterials.clear();
+
+    sceneStream = std::make_unique<SceneStream>();
+    sceneStream->start(filename, dirname, textureLoader.get());
+}
+
+void OpenGLViewer::uploadBatches() {
+    while (auto batch = sceneStream->pop()) {
+        for (size_t i = streamMaterials.size(); i < batch->materials.size(); i++) {
+            const auto &m = batch->materials[i];
+
+            MaterialInfo material;
+            material.diffuse = QVector3D(m.diffuse[0], m.diffuse[1], m.diffuse[2]);
+            material.specular = QVector3D(m.specular[0], m.specular[1], m.specular[2]);
+            material.shininess = m.shininess;
+            material.diffuse_texture = loadTexture(*textureRegistry, sceneDirname, m.diffuse_texname);
+            material.specular_texture = loadTexture(*textureRegistry, sceneDirname, m.specular_texname);
+            streamMaterials.push_back(material);
+        }
+
+        const int base = sceneVao->numIndices();
+        sceneVao->appendStream({ batch->positions.data(), batch->normals.data(), batch->texcoords.data() },
+                               batch->numVertices(), batch->indices.data(), batch->indices.size());
+
+        for (const auto &seg : batch->segments) {
+            SegmentInfo segment;
+            segment.start = base + seg.start;
+            segment.count = seg.count;
+            if (seg.material >= 0 && seg.material < streamMaterials.size()) {
+                segment.material = streamMaterials[seg.material];
+            }
+            sceneVao->addSegment(segment);
+        }
+    }
+
+    if (sceneStream->finished()) {
+        const std::string errmsg = sceneStream->errmsg();
+        if (!errmsg.empty()) {
+            WarnMsg("%s\n", errmsg.c_str());
+        }
+        sceneStream = nullptr;
+        textureLoader->clear();
+        printTextureStats(textureRegistry->stats());
+        printMemoryStats("scene", sceneVao->memoryStats());
+    }
 }
 
 void OpenGLViewer::setAAMethod(int type, int subsample) {
@@ -168,6 +410,34 @@ void OpenGLViewer::setAAMethod(int type, int subsample) {
     updateFboSize();
 }
 
+void OpenGLViewer::setIndirectDraw(bool enable) {
+    indirectDraw = enable;
+    cpuTimeMs = 0.0;
+}
+
+void OpenGLViewer::setGpuCulling(bool enable) {
+    gpuCulling = enable;
+    cpuTimeMs = 0.0;
+    if (sceneCuller) {
+        sceneCuller->invalidateHiZ();
+    }
+}
+
+void OpenGLViewer::setDepthPrepass(bool enable) {
+    depthPrepass = enable;
+    if (gbufTimer) {
+        gbufTimer->clear();
+    }
+}
+
+void OpenGLViewer::setTiledResolve(bool enable) {
+    tiledResolve = enable;
+}
+
+void OpenGLViewer::setEdgeListResolve(bool enable) {
+    edgeListResolve = enable;
+}
+
 void OpenGLViewer::initializeGL() {
     initializeOpenGLFunctions();
 
@@ -178,30 +448,59 @@ void OpenGLViewer::initializeGL() {
     
     load(std::string(DATA_DIRECTORY) + "sponza.obj");
 
-    shader = std::unique_ptr<QOpenGLShaderProgram>(
-        buildGLSLProgram(QString(SHADER_DIRECTORY) + "render"));
+    // Programs of the scene are built on demand for the materials drawn.
+    shaders = std::make_unique<ShaderPermutations>(
+        QString(SHADER_DIRECTORY) + "render", kMaterialFeatureNames);
 
-    gbufShader = std::unique_ptr<QOpenGLShaderProgram>(
-        buildGLSLProgram(QString(SHADER_DIRECTORY) + "gbuffer"));
+    gbufShaders = std::make_unique<ShaderPermutations>(
+        QString(SHADER_DIRECTORY) + "gbuffer", kMaterialFeatureNames);
 
-    csShader = std::unique_ptr<QOpenGLShaderProgram>(
-        buildGLSLComputeShader(QString(SHADER_DIRECTORY) + "msaa"));
+    // Programs of msaa.cs are built on demand by resolveProgram().
+    edgeList = std::make_unique<EdgeList>();
 
     displayShader = std::unique_ptr<QOpenGLShaderProgram>(
         buildGLSLProgram(QString(SHADER_DIRECTORY) + "display"));
+
+    cullShader = std::unique_ptr<QOpenGLShaderProgram>(
+        buildGLSLComputeShader(QString(SHADER_DIRECTORY) + "cull"));
+
+    hizShader = std::unique_ptr<QOpenGLShaderProgram>(
+        buildGLSLComputeShader(QString(SHADER_DIRECTORY) + "hiz"));
+
+    hizShaderMS = std::unique_ptr<QOpenGLShaderProgram>(
+        buildGLSLComputeShader(QString(SHADER_DIRECTORY) + "hiz", "#define MULTISAMPLE\n"));
+
+    depthShader = std::unique_ptr<QOpenGLShaderProgram>(
+        buildGLSLProgram(QString(SHADER_DIRECTORY) + "depth"));
+
+    const ProgramCache::Stats &programStats = ProgramCache::stats();
+    printf("[INFO] programs: %d from binary cache (%.1f ms), %d compiled (%.1f ms)\n",
+           programStats.hits, programStats.hitMs, programStats.compiles, programStats.compileMs);
+
+    // Depth pre-pass and G-buffer pass.
+    gbufTimer = std::make_unique<GpuTimer>(2);
 }
 
 void OpenGLViewer::paintGL() {
+    if (sceneStream) uploadBatches();
     if (!sceneVao) return;
 
+    QElapsedTimer cpuTimer;
+    cpuTimer.start();
+
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+    sceneVao->setMultiDrawIndirect(indirectDraw);
     if (aaMethod.type == 0) {
         drawScene();
     } else {
         drawGbuffer();
         drawSceneCS();
     }
+
+    // Time to issue the commands, not to execute them on GPU.
+    const double elapsed = cpuTimer.nsecsElapsed() * 1.0e-6;
+    cpuTimeMs = cpuTimeMs > 0.0 ? cpuTimeMs * 0.95 + elapsed * 0.05 : elapsed;
 }
 
 void OpenGLViewer::resizeGL(int w, int h) {
@@ -209,23 +508,55 @@ void OpenGLViewer::resizeGL(int w, int h) {
 
     updateFboSize();
 
-    renderTargetCS = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
-    renderTargetCS->setFormat(QOpenGLTexture::TextureFormat::RGBA8_SNorm);
-    renderTargetCS->setSize(width(), height());
-    renderTargetCS->allocateStorage(QOpenGLTexture::PixelFormat::RGBA, QOpenGLTexture::PixelType::UInt8);
+    // Reallocated only when the window grows out of it.
+    if (!renderTargetCS || renderTargetCS->width() < width() || renderTargetCS->height() < height()) {
+        renderTargetCS = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
+        renderTargetCS->setFormat(QOpenGLTexture::TextureFormat::RGBA8_SNorm);
+        renderTargetCS->setSize(nextPowerOfTwo(width()), nextPowerOfTwo(height()));
+        renderTargetCS->allocateStorage(QOpenGLTexture::PixelFormat::RGBA, QOpenGLTexture::PixelType::UInt8);
+    }
 
     camera->setPerspective(cameraFov, (float)width() / (float)height(), cameraNearClip, cameraFarClip);
 }
 
+// G-buffers are kept for each number of samples and resized in place, so
+// resizing the window rarely allocates. updateFboSize() frees the others.
+GBuffer *OpenGLViewer::acquireGbuffer(int w, int h, int samples) {
+    auto &pooled = gbufferPool[samples];
+    if (pooled) {
+        pooled->resize(w, h);
+    } else {
+        pooled = std::make_unique<GBuffer>(w, h, samples);
+    }
+    return pooled.get();
+}
+
 void OpenGLViewer::updateFboSize() {
-    QSize bufferSize(width() * aaMethod.subsample, height() * aaMethod.subsample);
-    gbufFbo = std::make_unique<QOpenGLFramebufferObject>(
-        bufferSize, QOpenGLFramebufferObject::Attachment::Depth,
-        QOpenGLTexture::Target2D, QOpenGLTexture::RGBA16F);
-    gbufFbo->addColorAttachment(bufferSize, QOpenGLTexture::RGBA16F);
-    gbufFbo->addColorAttachment(bufferSize, QOpenGLTexture::RGBA8_SNorm);
-    gbufFbo->addColorAttachment(bufferSize, QOpenGLTexture::RGBA8_SNorm);
-    gbufFbo->addColorAttachment(bufferSize, QOpenGLTexture::R32F);
+    // MSAA rasterizes at the window resolution with subsample^2 samples,
+    // unless the device has no multisampled targets.
+    const int samples = aaMethod.subsample * aaMethod.subsample;
+    if (aaMethod.type == 2 && samples > 1) {
+        gbuffer = acquireGbuffer(width(), height(), samples);
+        if (gbuffer->samples() > 1) {
+            releaseUnusedGbuffers();
+            return;
+        }
+        gbufferPool.erase(samples);
+    }
+
+    gbuffer = acquireGbuffer(width() * aaMethod.subsample, height() * aaMethod.subsample, 1);
+    releaseUnusedGbuffers();
+}
+
+// Frees the G-buffers of other AA methods.
+void OpenGLViewer::releaseUnusedGbuffers() {
+    for (auto it = gbufferPool.begin(); it != gbufferPool.end();) {
+        if (it->second.get() != gbuffer) {
+            it = gbufferPool.erase(it);
+        } else {
+            ++it;
+        }
+    }
 }
 
 void OpenGLViewer::mousePressEvent(QMouseEvent* ev) {
@@ -253,65 +584,98 @@ void OpenGLViewer::onAnimate() {
 }
 
 void OpenGLViewer::drawScene() {
-    shader->bind();
+    // No depth of this path is kept, so only the frustum is tested.
+    const bool culling = gpuCulling && sceneCuller && cullShader;
+    if (culling) {
+        sceneCuller->invalidateHiZ();
+        sceneCuller->cull(*cullShader, camera->mvpMat(), false);
+    }
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    shader->setUniformValue("u_mvMat", camera->mvMat());
-    shader->setUniformValue("u_mvpMat", camera->mvpMat());
-    shader->setUniformValue("u_normMat", camera->normMat());
-    shader->setUniformValue("u_lightPos", lightPos);
-
-    sceneVao->drawAs(GL_TRIANGLES, *shader);
-
-    shader->release();
+    auto setup = [&](QOpenGLShaderProgram &program) {
+        program.setUniformValue("u_mvMat", camera->mvMat());
+        program.setUniformValue("u_mvpMat", camera->mvpMat());
+        program.setUniformValue("u_normMat", camera->normMat());
+        program.setUniformValue("u_lightPos", lightPos);
+        program.setUniformValue("u_posScale", sceneVao->dequantScale(0));
+        program.setUniformValue("u_posOffset", sceneVao->dequantOffset(0));
+    };
+
+    if (culling) {
+        sceneVao->drawIndirect(GL_TRIANGLES, sceneCuller->commandBuffer(), sceneCuller->groups(), *shaders, setup);
+    } else {
+        sceneVao->drawAs(GL_TRIANGLES, *shaders, setup);
+    }
 }
 
 void OpenGLViewer::drawGbuffer() {
-    glViewport(0, 0, width() * aaMethod.subsample, height() * aaMethod.subsample);
+    // Clusters hidden in the previous frame are skipped. Those becoming
+    // visible appear one frame late.
+    QOpenGLShaderProgram *hiz = gbuffer->samples() > 1 ? hizShaderMS.get() : hizShader.get();
+    const bool culling = gpuCulling && sceneCuller && cullShader && hiz;
+    if (culling) {
+        sceneCuller->cull(*cullShader, camera->mvpMat(), true);
+    }
 
-    gbufShader->bind();
-    gbufFbo->bind();
+    gbufTimer->begin();
+    gbuffer->bind();
+    gbuffer->clear();
+
+    // Positions only, so the G-buffer is then shaded once per sample.
+    const bool prepass = depthPrepass && depthShader;
+    if (prepass) {
+        depthShader->bind();
+        depthShader->setUniformValue("u_mvpMat", camera->mvpMat());
+        depthShader->setUniformValue("u_posScale", sceneVao->dequantScale(0));
+        depthShader->setUniformValue("u_posOffset", sceneVao->dequantOffset(0));
+
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        if (culling) {
+            sceneVao->drawDepth(GL_TRIANGLES, sceneCuller->commandBuffer(), (GLsizei)sceneCuller->numClusters());
+        } else {
+            sceneVao->drawDepth(GL_TRIANGLES);
+        }
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 
-    GLenum bufs[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
-                      GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3,
-                      GL_COLOR_ATTACHMENT4 };
-    auto func = QOpenGLContext::currentContext()->extraFunctions();
-    func->glDrawBuffers(5, bufs);
+        depthShader->release();
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
+    gbufTimer->mark();
 
-    gbufShader->setUniformValue("u_mvpMat", camera->mvpMat());
+    auto setup = [&](QOpenGLShaderProgram &program) {
+        program.setUniformValue("u_mvpMat", camera->mvpMat());
+        program.setUniformValue("u_posScale", sceneVao->dequantScale(0));
+        program.setUniformValue("u_posOffset", sceneVao->dequantOffset(0));
+    };
 
-    sceneVao->drawAs(GL_TRIANGLES, *gbufShader);
+    if (culling) {
+        sceneVao->drawIndirect(GL_TRIANGLES, sceneCuller->commandBuffer(), sceneCuller->groups(), *gbufShaders, setup);
+    } else {
+        sceneVao->drawAs(GL_TRIANGLES, *gbufShaders, setup);
+    }
+
+    if (prepass) {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
+
+    gbuffer->release();
+    gbufTimer->mark();
+    gbufTimer->end();
 
-    gbufShader->release();
-    gbufFbo->release();
+    if (culling) {
+        sceneCuller->buildHiZ(*hiz, gbuffer->depthTexture(), gbuffer->target(), gbuffer->width(),
+                              gbuffer->height(), camera->mvpMat());
+    }
 
     glViewport(0, 0, width(), height());
 }
 
 void OpenGLViewer::drawSceneCS() {
-    csShader->bind();
-
-    csShader->setUniformValue("u_mvMat", camera->mvMat());
-    csShader->setUniformValue("u_normMat", camera->mvMat());
-    csShader->setUniformValue("u_lightPos", lightPos);
-    csShader->setUniformValue("u_aaType", aaMethod.type);
-    csShader->setUniformValue("u_subsample", aaMethod.subsample);
-
-    auto func = QOpenGLContext::currentContext()->extraFunctions();
-    func->glBindImageTexture(0, gbufFbo->textures()[0], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16F);
-    func->glBindImageTexture(1, gbufFbo->textures()[1], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16F);
-    func->glBindImageTexture(2, gbufFbo->textures()[2], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8_SNORM);
-    func->glBindImageTexture(3, gbufFbo->textures()[3], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8_SNORM);
-    func->glBindImageTexture(4, gbufFbo->textures()[4], 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
-    func->glBindImageTexture(5, renderTargetCS->textureId(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8_SNORM);
-
-    const int localSize = 32;
-    func->glDispatchCompute((width() + localSize - 1) / localSize, (height() + localSize - 1) / localSize, 1);
-
-    csShader->release();
+    dispatchResolve(tiledResolve);
 
     // Draw antialiased scene.
     displayShader->bind();
@@ -320,6 +684,8 @@ void OpenGLViewer::drawSceneCS() {
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, renderTargetCS->textureId());
+    displayShader->setUniformValue("u_texScale", QVector2D((float)width() / renderTargetCS->width(),
+                                                           (float)height() / renderTargetCS->height()));
 
     squareVao->drawAs(GL_TRIANGLES);
 
@@ -328,3 +694,180 @@ void OpenGLViewer::drawSceneCS() {
 
     displayShader->release();
 }
+
+// Shades the G-buffer into renderTargetCS.
+void OpenGLViewer::dispatchResolve(bool tiled) {
+    ResolveKernel kernel = ResolveKernel::Global;
+    int localSize = 0;
+    if (edgeListResolve && aaMethod.type == 2) {
+        kernel = ResolveKernel::EdgeList;
+        localSize = edgeListLocalSize;
+    } else if (tiled && gbuffer->samples() == 1 && aaMethod.subsample <= resolveMaxSubsample) {
+        kernel = ResolveKernel::Tiled;
+        localSize = resolveTileSize;
+    } else {
+        localSize = tunedResolveLocalSize();
+    }
+    runResolve(kernel, localSize);
+}
+
+void OpenGLViewer::runResolve(ResolveKernel kernel, int localSize) {
+    QOpenGLShaderProgram *cs = resolveProgram(kernel, localSize);
+    if (!cs) return;
+
+    cs->bind();
+
+    cs->setUniformValue("u_mvMat", camera->mvMat());
+    cs->setUniformValue("u_normMat", camera->mvMat());
+    cs->setUniformValue("u_invProjMat", camera->projMat().inverted());
+    cs->setUniformValue("u_lightPos", lightPos);
+    cs->setUniformValue("u_gbufferSize", QVector2D((float)gbuffer->width(), (float)gbuffer->height()));
+
+    auto func = QOpenGLContext::currentContext()->extraFunctions();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(gbuffer->target(), gbuffer->depthTexture());
+    func->glBindImageTexture(0, gbuffer->normalTexture(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG16UI);
+    func->glBindImageTexture(1, gbuffer->albedoTexture(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8);
+    func->glBindImageTexture(2, renderTargetCS->textureId(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8_SNORM);
+
+    if (kernel == ResolveKernel::EdgeList) {
+        edgeList->resolve(*cs, width(), height(), localSize);
+    } else {
+        func->glDispatchCompute((width() + localSize - 1) / localSize, (height() + localSize - 1) / localSize, 1);
+    }
+
+    cs->release();
+    glBindTexture(gbuffer->target(), 0);
+}
+
+// Picks the fastest workgroup size of the global kernel for the current AA
+// method by timing a few dispatches of each, once per method.
+int OpenGLViewer::tunedResolveLocalSize() {
+    const ResolveKey key = { ResolveKernel::Global, gbuffer->samples() > 1, aaMethod.type, aaMethod.subsample, 0 };
+    auto it = resolveLocalSizes.find(key);
+    if (it != resolveLocalSizes.end()) {
+        return it->second;
+    }
+
+    int best = 16;
+    QOpenGLTimeMonitor monitor;
+    monitor.setSampleCount(2);
+    if (monitor.create()) {
+        double bestMs = 1.0e20;
+        for (int localSize : { 8, 16, 32 }) {
+            runResolve(ResolveKernel::Global, localSize);
+
+            monitor.reset();
+            monitor.recordSample();
+            for (int i = 0; i < 10; i++) {
+                runResolve(ResolveKernel::Global, localSize);
+            }
+            monitor.recordSample();
+            const double ms = monitor.waitForIntervals()[0] * 1.0e-6 / 10;
+            if (ms < bestMs) {
+                bestMs = ms;
+                best = localSize;
+            }
+        }
+        printf("[INFO] msaa.cs: local size %dx%d for AA type %d, subsample %d (%.3f ms)\n",
+               best, best, aaMethod.type, aaMethod.subsample, bestMs);
+    }
+
+    resolveLocalSizes[key] = best;
+    return best;
+}
+
+QOpenGLShaderProgram *OpenGLViewer::resolveProgram(ResolveKernel kernel, int localSize) {
+    const bool multisample = gbuffer->samples() > 1;
+    const ResolveKey key = { kernel, multisample, aaMethod.type, aaMethod.subsample, localSize };
+    auto it = resolvePrograms.find(key);
+    if (it != resolvePrograms.end()) {
+        return it->second.get();
+    }
+
+    QByteArray defines;
+    defines += "#define AA_TYPE " + QByteArray::number(aaMethod.type) + "\n";
+    defines += "#define SUBSAMPLE " + QByteArray::number(aaMethod.subsample) + "\n";
+    if (multisample) {
+        defines += "#define MULTISAMPLE\n";
+        defines += "#define NUM_SAMPLES " + QByteArray::number(gbuffer->samples()) + "\n";
+    }
+
+    switch (kernel) {
+    case ResolveKernel::Global:
+        defines += "#define LOCAL_SIZE " + QByteArray::number(localSize) + "\n";
+        break;
+    case ResolveKernel::Tiled:
+        // Tiles are sized for the subsample of this program.
+        defines += "#define TILED\n";
+        defines += "#define TILE_SIZE " + QByteArray::number(localSize) + "\n";
+        defines += "#define MAX_SUBSAMPLE " + QByteArray::number(aaMethod.subsample) + "\n";
+        break;
+    case ResolveKernel::EdgeList:
+        defines += "#define EDGE_LIST\n";
+        defines += "#define EDGE_LIST_LOCAL_SIZE " + QByteArray::number(localSize) + "\n";
+        break;
+    }
+
+    auto &program = resolvePrograms[key];
+    program.reset(buildGLSLComputeShader(QString(SHADER_DIRECTORY) + "msaa", defines));
+    return program.get();
+}
+
+void OpenGLViewer::benchmarkResolve(int frames) {
+    if (!sceneVao || !gbuffer) return;
+
+    makeCurrent();
+
+    QOpenGLTimeMonitor monitor;
+    monitor.setSampleCount(2);
+    if (!monitor.create()) {
+        WarnMsg("Timer queries are not supported.");
+        return;
+    }
+
+    // Kernels are named explicitly, so the options in the GUI do not matter.
+    auto timeResolve = [&](ResolveKernel kernel, int localSize) {
+        runResolve(kernel, localSize);
+
+        monitor.reset();
+        monitor.recordSample();
+        for (int i = 0; i < frames; i++) {
+            runResolve(kernel, localSize);
+        }
+        monitor.recordSample();
+        return monitor.waitForIntervals()[0] * 1.0e-6 / frames;
+    };
+
+    printf("[INFO] resolve of %dx%d pixels in ms/frame, %d frames\n", width(), height(), frames);
+    printf("[INFO]   type  subsample   global    tuned    tiled  edge-list\n");
+
+    const AAMethod current = aaMethod;
+    for (int type = 1; type <= 2; type++) {
+        for (int subsample = 2; subsample <= 4; subsample++) {
+            // All the kernels read the same supersampled G-buffer.
+            aaMethod.type = type;
+            aaMethod.subsample = subsample;
+            gbuffer = acquireGbuffer(width() * subsample, height() * subsample, 1);
+            drawGbuffer();
+
+            // The baseline is the 32x32 kernel used before tuning. Tuning
+            // dispatches its candidates before the tuned size is timed.
+            const double global = timeResolve(ResolveKernel::Global, 32);
+            const int tunedSize = tunedResolveLocalSize();
+            const double tuned = timeResolve(ResolveKernel::Global, tunedSize);
+            const double tiled = timeResolve(ResolveKernel::Tiled, resolveTileSize);
+            if (type == 2) {
+                const double edges = timeResolve(ResolveKernel::EdgeList, edgeListLocalSize);
+                printf("[INFO]   MSAA  %9d  %7.3f  %7.3f  %7.3f  %9.3f\n", subsample, global, tuned, tiled, edges);
+            } else {
+                printf("[INFO]   SSAA  %9d  %7.3f  %7.3f  %7.3f  %9s\n", subsample, global, tuned, tiled, "-");
+            }
+        }
+    }
+
+    // The rows above grow the G-buffer to 4x4 subsamples.
+    aaMethod = current;
+    updateFboSize();
+    gbuffer->shrink();
+}
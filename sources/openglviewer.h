@@ -6,7 +6,9 @@
 #define _OPENGLVIEWER_H_
 
 #include <string>
+#include <map>
 #include <memory>
+#include <tuple>
 
 #include <QtCore/qtimer.h>
 #include <QtWidgets/qopenglwidget.h>
@@ -14,16 +16,44 @@
 #include <QtGui/qopenglfunctions.h>
 #include <QtGui/qopenglshaderprogram.h>
 #include <QtGui/qopengltexture.h>
-#include <QtGui/qopenglframebufferobject.h>
 
 #include "vertexarrayobject.h"
 #include "arcballcamera.h"
+#include "gbuffer.h"
+#include "gputimer.h"
+#include "textureloader.h"
+
+struct SceneBuffers;
+class EdgeList;
+class SceneCuller;
+class SceneStream;
+class TextureRegistry;
 
 struct AAMethod {
     int type = 0;
     int subsample = 2;
 };
 
+enum class ResolveKernel {
+    Global,
+    Tiled,
+    EdgeList
+};
+
+//! Permutation of msaa.cs. Each program is built with its own constants.
+struct ResolveKey {
+    ResolveKernel kernel;
+    bool multisample;
+    int aaType;
+    int subsample;
+    int localSize;
+
+    bool operator<(const ResolveKey &other) const {
+        return std::tie(kernel, multisample, aaType, subsample, localSize) <
+               std::tie(other.kernel, other.multisample, other.aaType, other.subsample, other.localSize);
+    }
+};
+
 class OpenGLViewer : public QOpenGLWidget, protected QOpenGLFunctions {
     Q_OBJECT
 
@@ -33,6 +63,32 @@ public:
 
     void load(const std::string &filename);
     void setAAMethod(int type, int subsample);
+    //! Takes effect only without GPU culling, whose clusters are always
+    //! drawn by glMultiDrawElementsIndirect.
+    void setIndirectDraw(bool enable);
+    void setGpuCulling(bool enable);
+    void setDepthPrepass(bool enable);
+    void setTiledResolve(bool enable);
+    void setEdgeListResolve(bool enable);
+
+    //! Prints GPU times of the resolve in msaa.cs with and without tiles
+    //! in shared memory, for SSAA and MSAA at subsample 2, 3 and 4.
+    void benchmarkResolve(int frames = 100);
+
+    //! CPU time to submit a frame in milliseconds, averaged over frames.
+    double cpuFrameTime() const {
+        return cpuTimeMs;
+    }
+
+    //! GPU time of the depth pre-pass and the G-buffer pass in milliseconds,
+    //! averaged over frames. Zero before they are measured.
+    double prepassTime() const {
+        return gbufTimer ? gbufTimer->intervalMs(0) : 0.0;
+    }
+
+    double gbufferTime() const {
+        return gbufTimer ? gbufTimer->intervalMs(1) : 0.0;
+    }
 
 protected:
     void initializeGL() override;
@@ -48,23 +104,55 @@ private slots:
     void onAnimate();
 
 private:
+    void importScene(const std::string &filename, const std::string &dirname,
+                     const std::string &cachename);
+    void setScene(const SceneBuffers &buffers, const std::string &dirname);
+    void startStreaming(const std::string &filename, const std::string &dirname);
+    void uploadBatches();
     void drawScene();
     void drawGbuffer();
     void drawSceneCS();
+    void dispatchResolve(bool tiled);
+    void runResolve(ResolveKernel kernel, int localSize);
+    int tunedResolveLocalSize();
+    QOpenGLShaderProgram *resolveProgram(ResolveKernel kernel, int localSize);
     void updateFboSize();
+    GBuffer *acquireGbuffer(int w, int h, int samples);
+    void releaseUnusedGbuffers();
 
-    std::unique_ptr<QOpenGLShaderProgram> shader = nullptr;
-    std::unique_ptr<QOpenGLShaderProgram> gbufShader = nullptr;
-    std::unique_ptr<QOpenGLShaderProgram> csShader = nullptr;
+    std::unique_ptr<ShaderPermutations> shaders = nullptr;      //! render.vs/fs by material features.
+    std::unique_ptr<ShaderPermutations> gbufShaders = nullptr;  //! gbuffer.vs/fs by material features.
+    std::map<ResolveKey, std::unique_ptr<QOpenGLShaderProgram>> resolvePrograms;
+    std::map<ResolveKey, int> resolveLocalSizes;  //! Tuned, with localSize of the key 0.
     std::unique_ptr<QOpenGLShaderProgram> displayShader = nullptr;
+    std::unique_ptr<QOpenGLShaderProgram> cullShader = nullptr;
+    std::unique_ptr<QOpenGLShaderProgram> hizShader = nullptr;
+    std::unique_ptr<QOpenGLShaderProgram> hizShaderMS = nullptr;
+    std::unique_ptr<QOpenGLShaderProgram> depthShader = nullptr;
 
     std::unique_ptr<VertexArrayObject> sceneVao = nullptr;
     std::unique_ptr<VertexArrayObject> squareVao = nullptr;
-    std::unique_ptr<QOpenGLFramebufferObject> gbufFbo = nullptr;
+    std::map<int, std::unique_ptr<GBuffer>> gbufferPool;  //! Keyed by the number of samples.
+    GBuffer *gbuffer = nullptr;
     std::unique_ptr<QOpenGLTexture> renderTargetCS = nullptr;
     std::unique_ptr<ArcballCamera> camera = nullptr;
 
+    std::unique_ptr<TextureLoader> textureLoader = nullptr;
+    std::unique_ptr<TextureRegistry> textureRegistry = nullptr;
+    std::unique_ptr<SceneStream> sceneStream = nullptr;
+    std::unique_ptr<SceneCuller> sceneCuller = nullptr;
+    std::unique_ptr<GpuTimer> gbufTimer = nullptr;
+    std::unique_ptr<EdgeList> edgeList = nullptr;
+    std::vector<MaterialInfo> streamMaterials;
+    std::string sceneDirname;
+
     AAMethod aaMethod;
+    bool indirectDraw = true;
+    bool gpuCulling = true;
+    bool depthPrepass = false;
+    bool tiledResolve = true;
+    bool edgeListResolve = false;
+    double cpuTimeMs = 0.0;
 
     QTimer *timer = nullptr;
 };
@@ -0,0 +1,199 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _PROGRAMCACHE_H_
+#define _PROGRAMCACHE_H_
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <QtCore/qcryptographichash.h>
+#include <QtCore/qdir.h>
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qfile.h>
+#include <QtCore/qsavefile.h>
+#include <QtCore/qstandardpaths.h>
+#include <QtGui/qopenglcontext.h>
+#include <QtGui/qopenglextrafunctions.h>
+#include <QtGui/qopenglshaderprogram.h>
+
+/**
+ * On-disk cache of linked program binaries.
+ * @details
+ * A program is keyed by the SHA-1 of its stage sources and the vendor,
+ * renderer and version strings of the driver, so editing a shader or
+ * updating the driver misses the cache. build() loads the binary by
+ * glProgramBinary(), and compiles the sources when there is no entry, the
+ * driver rejects it or the context supports no binary format. Compiled
+ * programs are then written back to directory().
+ *
+ * -- Layout --
+ * Header, followed by the binary returned by glGetProgramBinary().
+ **/
+class ProgramCache {
+public:
+    typedef std::vector<std::pair<QOpenGLShader::ShaderType, QByteArray>> Sources;
+
+    struct Stats {
+        int hits = 0;
+        int compiles = 0;
+        double hitMs = 0.0;
+        double compileMs = 0.0;
+    };
+
+    //! Links the program of `sources`, or returns nullptr if it fails.
+    //! `name` is only used in messages.
+    static QOpenGLShaderProgram *build(const QString &name, const Sources &sources) {
+        QElapsedTimer timer;
+        timer.start();
+
+        auto func = QOpenGLContext::currentContext()->extraFunctions();
+        GLint numFormats = 0;
+        func->glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+        const QString path = numFormats > 0 && QDir().mkpath(directory())
+            ? directory() + "/" + key(sources) + ".bin" : QString();
+
+        auto program = std::make_unique<QOpenGLShaderProgram>();
+        if (!path.isEmpty() && load(path, *program)) {
+            const double ms = timer.nsecsElapsed() * 1.0e-6;
+            state().stats.hits++;
+            state().stats.hitMs += ms;
+            printf("[INFO] %s: loaded program binary in %.2f ms\n", qPrintable(name), ms);
+            return program.release();
+        }
+
+        // The program of a rejected binary is not reused.
+        program = std::make_unique<QOpenGLShaderProgram>();
+        for (const auto &source : sources) {
+            program->addShaderFromSourceCode(source.first, source.second);
+        }
+        if (!path.isEmpty() && program->create()) {
+            func->glProgramParameteri(program->programId(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+        if (!program->link()) {
+            return nullptr;
+        }
+
+        const double ms = timer.nsecsElapsed() * 1.0e-6;
+        state().stats.compiles++;
+        state().stats.compileMs += ms;
+        printf("[INFO] %s: compiled program in %.2f ms\n", qPrintable(name), ms);
+
+        if (!path.isEmpty() && !save(path, *program)) {
+            printf("[WARNING] failed to write program binary: %s\n", qPrintable(path));
+        }
+        return program.release();
+    }
+
+    static const Stats & stats() {
+        return state().stats;
+    }
+
+    //! Defaults to "programs" in the cache location of the application.
+    static QString directory() {
+        if (state().directory.isEmpty()) {
+            state().directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/programs";
+        }
+        return state().directory;
+    }
+
+    static void setDirectory(const QString &directory) {
+        state().directory = directory;
+    }
+
+private:
+    static constexpr uint32_t kMagic = 0x42504c47;  // "GLPB"
+
+    struct Header {
+        uint32_t magic;
+        uint32_t format;
+        uint32_t size;
+    };
+
+    struct State {
+        Stats stats;
+        QString directory;
+    };
+
+    static State & state() {
+        static State state;
+        return state;
+    }
+
+    static QString key(const Sources &sources) {
+        auto func = QOpenGLContext::currentContext()->extraFunctions();
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+            const char *str = (const char*)func->glGetString(name);
+            hash.addData(str ? str : "", str ? (int)strlen(str) + 1 : 1);
+        }
+        for (const auto &source : sources) {
+            const int32_t type = (int32_t)source.first;
+            hash.addData((const char*)&type, sizeof(type));
+            hash.addData(source.second);
+        }
+        return QString::fromLatin1(hash.result().toHex());
+    }
+
+    static bool load(const QString &path, QOpenGLShaderProgram &program) {
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly)) {
+            return false;
+        }
+
+        const QByteArray data = file.readAll();
+        Header header;
+        if (data.size() < (int)sizeof(Header)) {
+            return false;
+        }
+        memcpy(&header, data.constData(), sizeof(Header));
+        if (header.magic != kMagic || (int)header.size != data.size() - (int)sizeof(Header) || !program.create()) {
+            return false;
+        }
+
+        auto func = QOpenGLContext::currentContext()->extraFunctions();
+        func->glProgramBinary(program.programId(), header.format, data.constData() + sizeof(Header), header.size);
+
+        // With no shaders added, link() only reads the link status.
+        if (!program.link()) {
+            printf("[WARNING] program binary is rejected by the driver: %s\n", qPrintable(path));
+            return false;
+        }
+        return true;
+    }
+
+    static bool save(const QString &path, QOpenGLShaderProgram &program) {
+        auto func = QOpenGLContext::currentContext()->extraFunctions();
+        GLint length = 0;
+        func->glGetProgramiv(program.programId(), GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) {
+            return false;
+        }
+
+        QByteArray data(sizeof(Header) + length, 0);
+        GLsizei written = 0;
+        GLenum format = 0;
+        func->glGetProgramBinary(program.programId(), length, &written, &format, data.data() + sizeof(Header));
+        if (written <= 0) {
+            return false;
+        }
+
+        const Header header = { kMagic, (uint32_t)format, (uint32_t)written };
+        memcpy(data.data(), &header, sizeof(Header));
+        data.resize(sizeof(Header) + written);
+
+        // Written to a temporary file first, so a crash leaves no partial entry.
+        QSaveFile file(path);
+        if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size()) {
+            return false;
+        }
+        return file.commit();
+    }
+};
+
+#endif  // _PROGRAMCACHE_H_
@@ -0,0 +1,180 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _RINGBUFFER_H_
+#define _RINGBUFFER_H_
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <QtGui/qopenglcontext.h>
+#include <QtGui/qopenglextrafunctions.h>
+
+#include "glutils.h"
+
+/**
+ * Buffer for data written by CPU every frame.
+ * @details
+ * The buffer is split into `numFrames` regions which are used in turn.
+ * fence() ends the current frame and moves to the next region, which is
+ * reused only after GPU has finished the commands issued with it, so writing
+ * never waits for the frame being drawn.
+ * With ARB_buffer_storage, the buffer is mapped persistently and map()
+ * returns the pointer to GPU memory. Otherwise, data are written to CPU
+ * memory and uploaded by unmap().
+ *
+ * -- Usage --
+ * 1) call map() and write the data to the pointer.
+ * 2) call unmap(), which returns the offset of the data in bufferId().
+ * 3) issue the commands reading the data.
+ * 4) call fence() at the end of the frame.
+ **/
+class RingBuffer : protected QOpenGLExtraFunctions {
+public:
+    explicit RingBuffer(size_t frameSize, int numFrames = 3)
+        : numFrames_(numFrames) {
+        initializeOpenGLFunctions();
+        bufferStorage_ = glBufferStorageFunc();
+        allocate(frameSize);
+    }
+
+    RingBuffer(const RingBuffer &) = delete;
+    RingBuffer & operator=(const RingBuffer &) = delete;
+
+    virtual ~RingBuffer() {
+        release();
+    }
+
+    GLuint bufferId() const {
+        return buffer_;
+    }
+
+    //! Size of the whole buffer in bytes.
+    size_t size() const {
+        return frameSize_ * numFrames_;
+    }
+
+    //! Returns the memory to write `size` bytes. The buffer is reallocated
+    //! when a frame needs more than its region, so bufferId() can change.
+    uint8_t *map(size_t size) {
+        size = (size + 255) & ~(size_t)255;
+        if (head_ + size > frameSize_) {
+            if (head_ > 0) {
+                fence();
+            }
+            if (size > frameSize_) {
+                allocate(size);
+            }
+        }
+
+        mapOffset_ = frame_ * frameSize_ + head_;
+        mapSize_ = size;
+        head_ += size;
+
+        if (mapped_) {
+            return mapped_ + mapOffset_;
+        }
+        staging_.resize(size);
+        return staging_.data();
+    }
+
+    //! Makes the data written after map() visible to GPU and returns its
+    //! offset in bytes.
+    size_t unmap() {
+        if (!mapped_) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, mapOffset_, mapSize_, staging_.data());
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+        return mapOffset_;
+    }
+
+    //! Ends the frame. Commands reading the region must be issued before.
+    void fence() {
+        if (fences_[frame_]) {
+            glDeleteSync(fences_[frame_]);
+        }
+        fences_[frame_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        frame_ = (frame_ + 1) % numFrames_;
+        head_ = 0;
+        wait(frame_);
+    }
+
+private:
+    //! Waits until GPU finishes reading the region of `frame`.
+    void wait(int frame) {
+        GLsync &sync = fences_[frame];
+        if (!sync) {
+            return;
+        }
+
+        GLbitfield flags = 0;
+        for (;;) {
+            const GLenum result = glClientWaitSync(sync, flags, 1000000);
+            if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED) {
+                break;
+            }
+            // Commands may not have been sent yet.
+            flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        }
+        glDeleteSync(sync);
+        sync = nullptr;
+    }
+
+    void allocate(size_t frameSize) {
+        release();
+
+        frameSize_ = (frameSize + 255) & ~(size_t)255;
+        frame_ = 0;
+        head_ = 0;
+        fences_.assign(numFrames_, nullptr);
+
+        const size_t totalSize = frameSize_ * numFrames_;
+        glGenBuffers(1, &buffer_);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_);
+        if (bufferStorage_) {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            bufferStorage_(GL_COPY_WRITE_BUFFER, totalSize, nullptr, flags);
+            mapped_ = (uint8_t*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, totalSize, flags);
+        } else {
+            glBufferData(GL_COPY_WRITE_BUFFER, totalSize, nullptr, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    void release() {
+        for (int i = 0; i < (int)fences_.size(); i++) {
+            wait(i);
+        }
+
+        if (buffer_) {
+            if (mapped_) {
+                glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_);
+                glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+                mapped_ = nullptr;
+            }
+            glDeleteBuffers(1, &buffer_);
+            buffer_ = 0;
+        }
+    }
+
+    const int numFrames_;
+    GLBufferStorageProc bufferStorage_ = nullptr;
+
+    GLuint buffer_ = 0;
+    uint8_t *mapped_ = nullptr;
+    std::vector<uint8_t> staging_;
+    std::vector<GLsync> fences_;
+
+    size_t frameSize_ = 0;
+    int frame_ = 0;
+    size_t head_ = 0;
+    size_t mapOffset_ = 0;
+    size_t mapSize_ = 0;
+};
+
+#endif  // _RINGBUFFER_H_
@@ -0,0 +1,305 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _SCENECACHE_H_
+#define _SCENECACHE_H_
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <QtCore/qfile.h>
+#include <QtCore/qfileinfo.h>
+#include <QtCore/qdatetime.h>
+
+#include "common.h"
+
+//! Range of indices drawn with one material.
+struct SceneSegment {
+    int32_t start = 0;
+    int32_t count = 0;
+    float diffuse[3] = { 1.0f, 1.0f, 1.0f };
+    float specular[3] = { 0.0f, 0.0f, 0.0f };
+    float shininess = 1.0f;
+    int32_t diffuseTex = -1;   //! Index to the texture path list, or -1.
+    int32_t specularTex = -1;
+    int32_t bumpTex = -1;
+};
+
+//! Flattened scene ready to be uploaded to VertexArrayObject.
+//! Vertex data is referenced, not owned.
+struct SceneBuffers {
+    const float *positions = nullptr;
+    const float *normals = nullptr;
+    const float *texcoords = nullptr;
+    uint32_t numVertices = 0;
+    const uint32_t *indices = nullptr;
+    uint32_t numIndices = 0;
+    std::vector<SceneSegment> segments;
+    std::vector<std::string> texturePaths;
+};
+
+/**
+ * Binary cache of the imported scene.
+ * @details
+ * The cache is written next to the OBJ file after the first import. It holds
+ * the final vertex and index buffers, the segment table and the texture paths,
+ * together with the size and the modification time of every source file
+ * (.obj and .mtl). Opening maps the file and validates the sources and the
+ * payload hash, so the buffers can be uploaded without parsing the OBJ.
+ *
+ * -- Layout --
+ * Header, dependencies, segments, texture paths, positions, normals,
+ * texcoords and indices. Arrays are 4-byte aligned.
+ **/
+class SceneCache {
+public:
+    SceneCache() = default;
+    SceneCache(const SceneCache &) = delete;
+    SceneCache & operator=(const SceneCache &) = delete;
+
+    virtual ~SceneCache() {
+        close();
+    }
+
+    //! Maps the cache file. Returns false if the cache is missing, broken or
+    //! older than any of the source files.
+    bool open(const std::string &filename) {
+        close();
+
+        file_.setFileName(QString::fromStdString(filename));
+        if (!file_.open(QIODevice::ReadOnly)) {
+            return false;
+        }
+
+        const qint64 size = file_.size();
+        data_ = size >= (qint64)sizeof(Header) ? file_.map(0, size) : nullptr;
+        if (!data_) {
+            close();
+            return false;
+        }
+
+        const uchar *end = data_ + size;
+        Header header;
+        std::memcpy(&header, data_, sizeof(Header));
+        if (header.magic != kMagic || header.version != kVersion) {
+            close();
+            return false;
+        }
+
+        const uchar *payload = data_ + sizeof(Header);
+        if (header.payloadSize != (uint64_t)(end - payload) ||
+            hashBytes(payload, (size_t)header.payloadSize) != header.payloadHash) {
+            WarnMsg("Scene cache is broken: %s", filename.c_str());
+            close();
+            return false;
+        }
+
+        // Source files.
+        const uchar *ptr = payload;
+        for (uint32_t i = 0; i < header.numDependencies; i++) {
+            Dependency dep;
+            std::string path;
+            if (!read(ptr, end, &dep, sizeof(Dependency)) || !readString(ptr, end, path)) {
+                close();
+                return false;
+            }
+
+            QFileInfo info(QString::fromStdString(path));
+            if (!info.exists() || (uint64_t)info.size() != dep.size ||
+                info.lastModified().toMSecsSinceEpoch() != dep.mtime) {
+                close();
+                return false;
+            }
+        }
+
+        // Segments and texture paths.
+        buffers_ = SceneBuffers();
+        buffers_.segments.resize(header.numSegments);
+        if (header.numSegments > 0 &&
+            !read(ptr, end, &buffers_.segments[0], sizeof(SceneSegment) * header.numSegments)) {
+            close();
+            return false;
+        }
+
+        buffers_.texturePaths.resize(header.numTextures);
+        for (uint32_t i = 0; i < header.numTextures; i++) {
+            if (!readString(ptr, end, buffers_.texturePaths[i])) {
+                close();
+                return false;
+            }
+        }
+
+        // Vertex and index buffers are used in place.
+        const size_t numFloats = (size_t)header.numVertices * 8;
+        const size_t bufferSize = numFloats * sizeof(float) + (size_t)header.numIndices * sizeof(uint32_t);
+        if ((size_t)(end - ptr) != bufferSize) {
+            close();
+            return false;
+        }
+        buffers_.numVertices = header.numVertices;
+        buffers_.numIndices = header.numIndices;
+        buffers_.positions = reinterpret_cast<const float*>(ptr);
+        buffers_.normals = buffers_.positions + header.numVertices * 3;
+        buffers_.texcoords = buffers_.normals + header.numVertices * 3;
+        buffers_.indices = reinterpret_cast<const uint32_t*>(buffers_.positions + numFloats);
+
+        return true;
+    }
+
+    void close() {
+        if (data_) {
+            file_.unmap(data_);
+            data_ = nullptr;
+        }
+        if (file_.isOpen()) {
+            file_.close();
+        }
+        buffers_ = SceneBuffers();
+    }
+
+    //! Buffers in the mapped cache, valid until close().
+    const SceneBuffers & buffers() const {
+        return buffers_;
+    }
+
+    //! Writes the cache. `sources` are the files the scene is built from.
+    static bool write(const std::string &filename, const std::vector<std::string> &sources,
+                      const SceneBuffers &buffers) {
+        std::vector<uchar> payload;
+
+        uint32_t numDependencies = 0;
+        for (const auto &path : sources) {
+            QFileInfo info(QString::fromStdString(path));
+            if (!info.exists()) {
+                continue;
+            }
+
+            Dependency dep;
+            dep.size = (uint64_t)info.size();
+            dep.mtime = info.lastModified().toMSecsSinceEpoch();
+            append(payload, &dep, sizeof(Dependency));
+            appendString(payload, path);
+            numDependencies++;
+        }
+
+        if (!buffers.segments.empty()) {
+            append(payload, &buffers.segments[0], sizeof(SceneSegment) * buffers.segments.size());
+        }
+        for (const auto &path : buffers.texturePaths) {
+            appendString(payload, path);
+        }
+
+        append(payload, buffers.positions, sizeof(float) * buffers.numVertices * 3);
+        append(payload, buffers.normals, sizeof(float) * buffers.numVertices * 3);
+        append(payload, buffers.texcoords, sizeof(float) * buffers.numVertices * 2);
+        append(payload, buffers.indices, sizeof(uint32_t) * buffers.numIndices);
+
+        Header header;
+        header.magic = kMagic;
+        header.version = kVersion;
+        header.numDependencies = numDependencies;
+        header.numSegments = (uint32_t)buffers.segments.size();
+        header.numTextures = (uint32_t)buffers.texturePaths.size();
+        header.numVertices = buffers.numVertices;
+        header.numIndices = buffers.numIndices;
+        header.payloadSize = payload.size();
+        header.payloadHash = hashBytes(payload.data(), payload.size());
+
+        // Write to a temporary file first, so an interrupted write never
+        // leaves a cache which looks valid.
+        const QString path = QString::fromStdString(filename);
+        QFile file(path + ".tmp");
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            return false;
+        }
+        bool success = file.write((const char*)&header, sizeof(Header)) == (qint64)sizeof(Header) &&
+                       file.write((const char*)payload.data(), payload.size()) == (qint64)payload.size();
+        file.close();
+
+        QFile::remove(path);
+        if (!success || !file.rename(path)) {
+            file.remove();
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr uint32_t kMagic = 0x43534c47;  // "GLSC"
+    static constexpr uint32_t kVersion = 2;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t numDependencies;
+        uint32_t numSegments;
+        uint32_t numTextures;
+        uint32_t numVertices;
+        uint32_t numIndices;
+        uint32_t reserved = 0;
+        uint64_t payloadSize;
+        uint64_t payloadHash;
+    };
+
+    struct Dependency {
+        uint64_t size;
+        int64_t mtime;
+    };
+
+    //! FNV-1a over 64-bit words.
+    static uint64_t hashBytes(const uchar *data, size_t size) {
+        uint64_t hash = 14695981039346656037ull;
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+            uint64_t word;
+            std::memcpy(&word, data + i, sizeof(uint64_t));
+            hash = (hash ^ word) * 1099511628211ull;
+        }
+        for (; i < size; i++) {
+            hash = (hash ^ data[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    static void append(std::vector<uchar> &out, const void *data, size_t size) {
+        const uchar *bytes = (const uchar*)data;
+        out.insert(out.end(), bytes, bytes + size);
+    }
+
+    //! Strings are stored as length and characters, padded to 4 bytes.
+    static void appendString(std::vector<uchar> &out, const std::string &str) {
+        const uint32_t length = (uint32_t)str.size();
+        append(out, &length, sizeof(uint32_t));
+        append(out, str.data(), str.size());
+        out.resize((out.size() + 3) & ~(size_t)3, 0);
+    }
+
+    static bool read(const uchar *&ptr, const uchar *end, void *out, size_t size) {
+        if ((size_t)(end - ptr) < size) {
+            return false;
+        }
+        std::memcpy(out, ptr, size);
+        ptr += size;
+        return true;
+    }
+
+    static bool readString(const uchar *&ptr, const uchar *end, std::string &str) {
+        uint32_t length;
+        if (!read(ptr, end, &length, sizeof(uint32_t)) || (size_t)(end - ptr) < length) {
+            return false;
+        }
+        str.assign((const char*)ptr, length);
+        ptr += (length + 3) & ~3u;
+        return ptr <= end;
+    }
+
+    QFile file_;
+    uchar *data_ = nullptr;
+    SceneBuffers buffers_;
+};
+
+#endif  // _SCENECACHE_H_
@@ -0,0 +1,258 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _SCENECULLER_H_
+#define _SCENECULLER_H_
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+
+#include <QtGui/qmatrix4x4.h>
+#include <QtGui/qvector2d.h>
+#include <QtGui/qopenglextrafunctions.h>
+#include <QtGui/qopenglshaderprogram.h>
+
+#include "vertexarrayobject.h"
+
+/**
+ * Culling of the scene on GPU.
+ * @details
+ * Segments are split into clusters of up to kClusterTriangles consecutive
+ * triangles, each bounded by a sphere. cull() runs a compute shader which
+ * writes one DrawElementsIndirectCommand per cluster to commandBuffer(),
+ * with no instance when the cluster is outside the view frustum or hidden
+ * behind the depth of the previous frame. The depth is kept as a max-depth
+ * pyramid (hierarchical Z) by buildHiZ().
+ * Clusters are sorted by the shader permutations of their segments, so the
+ * commands of each permutation are consecutive and listed by groups().
+ *
+ * -- Usage --
+ * 1) call setClusters() when the scene is loaded.
+ * 2) call cull() and draw with VertexArrayObject::drawIndirect().
+ * 3) call buildHiZ() with the depth of the frame for the next cull().
+ **/
+class SceneCuller : protected QOpenGLExtraFunctions {
+public:
+    static constexpr int kClusterTriangles = 128;
+    static constexpr int kLocalSize = 64;
+
+    SceneCuller() {
+        initializeOpenGLFunctions();
+        glGenBuffers(1, &clusterBuffer_);
+        glGenBuffers(1, &commandBuffer_);
+    }
+
+    SceneCuller(const SceneCuller &) = delete;
+    SceneCuller & operator=(const SceneCuller &) = delete;
+
+    virtual ~SceneCuller() {
+        glDeleteBuffers(1, &clusterBuffer_);
+        glDeleteBuffers(1, &commandBuffer_);
+        if (hizTexture_) {
+            glDeleteTextures(1, &hizTexture_);
+        }
+    }
+
+    //! Builds the clusters of the segments, given as {start, count} of
+    //! `indices`. Cluster i of segment s draws with material s, and with
+    //! the permutation `segmentFeatures`[s] if given.
+    void setClusters(const float *positions, const uint32_t *indices,
+                     const std::vector<std::pair<int, int>> &segments,
+                     const std::vector<uint32_t> &segmentFeatures = {}) {
+        std::vector<Cluster> clusters;
+        for (size_t s = 0; s < segments.size(); s++) {
+            const int start = segments[s].first;
+            const int numTris = start >= 0 ? segments[s].second / 3 : 0;
+            for (int t = 0; t < numTris; t += kClusterTriangles) {
+                Cluster cluster;
+                cluster.firstIndex = (uint32_t)(start + t * 3);
+                cluster.count = (uint32_t)(std::min(kClusterTriangles, numTris - t) * 3);
+                cluster.segment = (uint32_t)s;
+                cluster.padding = 0;
+                boundingSphere(positions, indices + cluster.firstIndex, cluster.count, cluster.sphere);
+                clusters.push_back(cluster);
+            }
+        }
+        numClusters_ = clusters.size();
+
+        auto features = [&](const Cluster &cluster) {
+            return cluster.segment < segmentFeatures.size() ? segmentFeatures[cluster.segment] : 0u;
+        };
+        std::stable_sort(clusters.begin(), clusters.end(), [&](const Cluster &a, const Cluster &b) {
+            return features(a) < features(b);
+        });
+        std::vector<uint32_t> sortedFeatures(clusters.size());
+        for (size_t i = 0; i < clusters.size(); i++) {
+            sortedFeatures[i] = features(clusters[i]);
+        }
+        groups_ = makeDrawGroups(sortedFeatures);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterBuffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(numClusters_, (size_t)1) * sizeof(Cluster),
+                     clusters.empty() ? nullptr : clusters.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(numClusters_, (size_t)1) * sizeof(DrawElementsIndirectCommand),
+                     nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        invalidateHiZ();
+    }
+
+    size_t numClusters() const {
+        return numClusters_;
+    }
+
+    GLuint commandBuffer() const {
+        return commandBuffer_;
+    }
+
+    //! Ranges of commandBuffer() drawn with the same permutation.
+    const std::vector<DrawGroup> & groups() const {
+        return groups_;
+    }
+
+    //! Forgets the depth of the previous frame, e.g., when the G-buffer is
+    //! resized. Clusters are then culled only by the frustum.
+    void invalidateHiZ() {
+        hizValid_ = false;
+    }
+
+    //! Writes the commands of the clusters visible with `mvpMat`.
+    //! Occlusion is tested only if `useHiZ` and the depth pyramid is valid.
+    void cull(QOpenGLShaderProgram &program, const QMatrix4x4 &mvpMat, bool useHiZ) {
+        if (numClusters_ == 0) {
+            return;
+        }
+        useHiZ = useHiZ && hizValid_;
+
+        program.bind();
+        program.setUniformValue("u_mvpMat", mvpMat);
+        program.setUniformValue("u_prevMvpMat", prevMvpMat_);
+        program.setUniformValue("u_useHiZ", useHiZ ? 1 : 0);
+        program.setUniformValue("u_hizSize", QVector2D((float)hizWidth_, (float)hizHeight_));
+        program.setUniformValue("u_hizLevels", hizLevels_);
+        program.setUniformValue("u_numClusters", (GLuint)numClusters_);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, clusterBuffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commandBuffer_);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, useHiZ ? hizTexture_ : 0);
+
+        glDispatchCompute((GLuint)((numClusters_ + kLocalSize - 1) / kLocalSize), 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+        program.release();
+    }
+
+    //! Builds the depth pyramid from the G-buffer depth texture drawn with
+    //! `mvpMat`. `depthTarget` is GL_TEXTURE_2D_MULTISAMPLE if multisampled.
+    void buildHiZ(QOpenGLShaderProgram &program, GLuint depthTexture, GLenum depthTarget,
+                  int width, int height, const QMatrix4x4 &mvpMat) {
+        if (width <= 0 || height <= 0) {
+            return;
+        }
+        allocateHiZ(width, height);
+
+        program.bind();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(depthTarget, depthTexture);
+
+        int w = width;
+        int h = height;
+        for (int level = 0; level < hizLevels_; level++) {
+            program.setUniformValue("u_level", level);
+            if (level > 0) {
+                glBindImageTexture(0, hizTexture_, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+            }
+            glBindImageTexture(1, hizTexture_, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            glDispatchCompute((w + 7) / 8, (h + 7) / 8, 1);
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+            w = std::max(1, w / 2);
+            h = std::max(1, h / 2);
+        }
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+        glBindTexture(depthTarget, 0);
+        program.release();
+
+        prevMvpMat_ = mvpMat;
+        hizValid_ = true;
+    }
+
+private:
+    //! Layout of `Cluster` in cull.cs (std430).
+    struct Cluster {
+        float sphere[4];
+        uint32_t firstIndex;
+        uint32_t count;
+        uint32_t segment;
+        uint32_t padding;
+    };
+
+    static void boundingSphere(const float *positions, const uint32_t *indices, size_t count, float sphere[4]) {
+        float lower[3] = { INFINITY, INFINITY, INFINITY };
+        float upper[3] = { -INFINITY, -INFINITY, -INFINITY };
+        for (size_t i = 0; i < count; i++) {
+            const float *p = &positions[indices[i] * 3];
+            for (int k = 0; k < 3; k++) {
+                lower[k] = std::min(lower[k], p[k]);
+                upper[k] = std::max(upper[k], p[k]);
+            }
+        }
+
+        float radius2 = 0.0f;
+        for (int k = 0; k < 3; k++) {
+            sphere[k] = (lower[k] + upper[k]) * 0.5f;
+        }
+        for (size_t i = 0; i < count; i++) {
+            const float *p = &positions[indices[i] * 3];
+            const float dx = p[0] - sphere[0];
+            const float dy = p[1] - sphere[1];
+            const float dz = p[2] - sphere[2];
+            radius2 = std::max(radius2, dx * dx + dy * dy + dz * dz);
+        }
+        sphere[3] = std::sqrt(radius2);
+    }
+
+    void allocateHiZ(int width, int height) {
+        if (hizTexture_ && width == hizWidth_ && height == hizHeight_) {
+            return;
+        }
+
+        if (hizTexture_) {
+            glDeleteTextures(1, &hizTexture_);
+        }
+        hizWidth_ = width;
+        hizHeight_ = height;
+        hizLevels_ = 1 + (int)std::floor(std::log2((double)std::max(width, height)));
+        hizValid_ = false;
+
+        glGenTextures(1, &hizTexture_);
+        glBindTexture(GL_TEXTURE_2D, hizTexture_);
+        glTexStorage2D(GL_TEXTURE_2D, hizLevels_, GL_R32F, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    GLuint clusterBuffer_ = 0;
+    GLuint commandBuffer_ = 0;
+    size_t numClusters_ = 0;
+    std::vector<DrawGroup> groups_;
+
+    GLuint hizTexture_ = 0;
+    int hizWidth_ = 0;
+    int hizHeight_ = 0;
+    int hizLevels_ = 0;
+    bool hizValid_ = false;
+    QMatrix4x4 prevMvpMat_;
+};
+
+#endif  // _SCENECULLER_H_
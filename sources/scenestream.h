@@ -0,0 +1,236 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _SCENESTREAM_H_
+#define _SCENESTREAM_H_
+
+#include <cstdint>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "materialreader.h"
+#include "textureloader.h"
+#include "tiny_obj_loader.h"
+
+//! Range of indices of a batch drawn with one material.
+struct StreamSegment {
+    int material;
+    int start;
+    int count;
+};
+
+//! Part of the scene ready to be appended to VertexArrayObject.
+//! Indices refer to the vertices of the batch.
+struct SceneBatch {
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<float> texcoords;
+    std::vector<uint32_t> indices;
+    std::vector<StreamSegment> segments;
+
+    //! Materials read so far. Only set when new materials have been read.
+    std::vector<tinyobj::material_t> materials;
+
+    size_t numVertices() const {
+        return positions.size() / 3;
+    }
+};
+
+/**
+ * Streaming OBJ import.
+ * @details
+ * A worker thread parses the OBJ file and packs the shapes into batches of
+ * about `batchVertices` vertices. The batches wait in a queue until they are
+ * taken by pop() on the rendering thread. When the queue is full, the worker
+ * waits, so no more than `maxBatches` batches are held at once.
+ **/
+class SceneStream {
+public:
+    explicit SceneStream(size_t batchVertices = 1 << 18, size_t maxBatches = 4)
+        : batchVertices_(batchVertices)
+        , maxBatches_(maxBatches) {
+    }
+
+    SceneStream(const SceneStream &) = delete;
+    SceneStream & operator=(const SceneStream &) = delete;
+
+    virtual ~SceneStream() {
+        stop();
+    }
+
+    //! Starts parsing. Textures of the materials are requested to
+    //! `textureLoader` as soon as they are read, if it is given.
+    void start(const std::string &filename, const std::string &dirname,
+               TextureLoader *textureLoader = nullptr) {
+        stop();
+
+        closed_ = false;
+        finished_ = false;
+        errmsg_.clear();
+        worker_ = std::thread([this, filename, dirname, textureLoader]() {
+            run(filename, dirname, textureLoader);
+        });
+    }
+
+    //! Stops the worker. Batches not taken yet are discarded.
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+            batches_.clear();
+        }
+        cond_.notify_all();
+
+        if (worker_.joinable()) {
+            worker_.join();
+        }
+    }
+
+    //! Takes the next batch, or returns nullptr when none is ready.
+    std::unique_ptr<SceneBatch> pop() {
+        std::unique_ptr<SceneBatch> batch = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (batches_.empty()) {
+                return nullptr;
+            }
+            batch = std::move(batches_.front());
+            batches_.pop_front();
+        }
+        cond_.notify_all();
+        return batch;
+    }
+
+    //! True when the whole file is parsed and all the batches are taken.
+    bool finished() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return finished_ && batches_.empty();
+    }
+
+    //! Warnings and errors of the parser, valid after finished() returns true.
+    std::string errmsg() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return errmsg_;
+    }
+
+private:
+    //! Packs the shapes emitted by the parser into batches.
+    class BatchBuilder : public tinyobj::ShapeCallback {
+    public:
+        explicit BatchBuilder(SceneStream *stream)
+            : stream_(stream) {
+        }
+
+        bool operator()(const tinyobj::shape_t &shape,
+                        const std::vector<tinyobj::material_t> &materials) override {
+            if (!batch_) {
+                batch_ = std::make_unique<SceneBatch>();
+            }
+
+            if (materials.size() != numMaterials_) {
+                batch_->materials = materials;
+                numMaterials_ = materials.size();
+            }
+
+            const auto &mesh = shape.mesh;
+            const size_t base = batch_->numVertices();
+            const size_t numVertices = mesh.positions.size() / 3;
+            append(batch_->positions, mesh.positions, numVertices * 3);
+            append(batch_->normals, mesh.normals, numVertices * 3);
+            append(batch_->texcoords, mesh.texcoords, numVertices * 2);
+
+            // Faces are triangulated, so face i has indices [3i, 3i + 3).
+            auto &segments = batch_->segments;
+            for (int i = 0; i < mesh.material_ids.size(); i++) {
+                const int start = (int)batch_->indices.size();
+                for (int j = 0; j < 3; j++) {
+                    batch_->indices.push_back((uint32_t)(base + mesh.indices[i * 3 + j]));
+                }
+
+                const int matId = mesh.material_ids[i];
+                if (!segments.empty() && segments.back().material == matId &&
+                    segments.back().start + segments.back().count == start) {
+                    segments.back().count += 3;
+                } else {
+                    segments.push_back({ matId, start, 3 });
+                }
+            }
+
+            if (batch_->numVertices() >= stream_->batchVertices_) {
+                return flush();
+            }
+            return true;
+        }
+
+        bool flush() {
+            if (!batch_) {
+                return true;
+            }
+            return stream_->push(std::move(batch_));
+        }
+
+    private:
+        //! Appends `count` values, padding with zeros when `src` is short.
+        static void append(std::vector<float> &dst, const std::vector<float> &src, size_t count) {
+            const size_t n = std::min(count, src.size());
+            dst.insert(dst.end(), src.begin(), src.begin() + n);
+            dst.resize(dst.size() + count - n, 0.0f);
+        }
+
+        SceneStream *stream_;
+        std::unique_ptr<SceneBatch> batch_ = nullptr;
+        size_t numMaterials_ = 0;
+    };
+
+    void run(const std::string &filename, const std::string &dirname, TextureLoader *textureLoader) {
+        BatchBuilder builder(this);
+        SceneMaterialReader matReader(dirname, textureLoader);
+        std::vector<tinyobj::material_t> materials;
+        std::string errmsg;
+        bool success = tinyobj::LoadObj(materials, errmsg, filename.c_str(), matReader, builder,
+                                        65536, tinyobj::triangulation);
+        if (success) {
+            builder.flush();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        errmsg_ = errmsg;
+        if (!success && !closed_) {
+            errmsg_ += "Failed to load file: " + filename + "\n";
+        }
+        finished_ = true;
+    }
+
+    //! Waits for room in the queue. Returns false when the stream is stopped.
+    bool push(std::unique_ptr<SceneBatch> batch) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this]() {
+            return closed_ || batches_.size() < maxBatches_;
+        });
+        if (closed_) {
+            return false;
+        }
+        batches_.push_back(std::move(batch));
+        return true;
+    }
+
+    const size_t batchVertices_;
+    const size_t maxBatches_;
+
+    std::thread worker_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::unique_ptr<SceneBatch>> batches_;
+    bool closed_ = false;
+    bool finished_ = false;
+    std::string errmsg_;
+};
+
+#endif  // _SCENESTREAM_H_
@@ -0,0 +1,106 @@
+#version 450
+
+// Writes the draw command of every cluster, with no instance when the
+// cluster is out of the view frustum or occluded in the previous frame.
+
+struct Cluster {
+    vec4 sphere;
+    uint firstIndex;
+    uint count;
+    uint segment;
+    uint padding;
+};
+
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(std430, binding = 1) readonly buffer Clusters {
+    Cluster clusters[];
+};
+
+layout(std430, binding = 2) writeonly buffer Commands {
+    DrawCommand commands[];
+};
+
+uniform mat4 u_mvpMat;
+uniform mat4 u_prevMvpMat;
+uniform int u_useHiZ;
+uniform vec2 u_hizSize;
+uniform int u_hizLevels;
+uniform uint u_numClusters;
+
+// Max depth in [0, 1] of the previous frame.
+layout(binding = 0) uniform sampler2D u_hiz;
+
+layout(local_size_x = 64) in;
+
+// Margin for the depth of the bounding spheres.
+float DEPTH_BIAS = 1.0e-3;
+
+bool insideFrustum(vec4 sphere) {
+    mat4 m = transpose(u_mvpMat);
+    vec4 planes[6] = vec4[](m[3] + m[0], m[3] - m[0],
+                            m[3] + m[1], m[3] - m[1],
+                            m[3] + m[2], m[3] - m[2]);
+    for (int i = 0; i < 6; i++) {
+        if (dot(planes[i].xyz, sphere.xyz) + planes[i].w < -sphere.w * length(planes[i].xyz)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool occluded(vec4 sphere) {
+    vec2 lower = vec2(1.0);
+    vec2 upper = vec2(-1.0);
+    float minDepth = 1.0;
+    for (int i = 0; i < 8; i++) {
+        vec3 corner = sphere.xyz + sphere.w * vec3((i & 1) != 0 ? 1.0 : -1.0,
+                                                   (i & 2) != 0 ? 1.0 : -1.0,
+                                                   (i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = u_prevMvpMat * vec4(corner, 1.0);
+        if (clip.w <= 0.0) {
+            // Crosses the near plane.
+            return false;
+        }
+        vec3 ndc = clip.xyz / clip.w;
+        lower = min(lower, ndc.xy);
+        upper = max(upper, ndc.xy);
+        minDepth = min(minDepth, ndc.z);
+    }
+
+    lower = clamp(lower * 0.5 + 0.5, 0.0, 1.0);
+    upper = clamp(upper * 0.5 + 0.5, 0.0, 1.0);
+    minDepth = minDepth * 0.5 + 0.5;
+
+    // The level where the rectangle covers at most 2x2 texels.
+    vec2 extent = (upper - lower) * u_hizSize;
+    int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, u_hizLevels - 1);
+    ivec2 size = textureSize(u_hiz, level);
+    ivec2 p0 = clamp(ivec2(lower * vec2(size)), ivec2(0), size - 1);
+    ivec2 p1 = clamp(ivec2(upper * vec2(size)), ivec2(0), size - 1);
+
+    float maxDepth = max(max(texelFetch(u_hiz, p0, level).x, texelFetch(u_hiz, ivec2(p1.x, p0.y), level).x),
+                         max(texelFetch(u_hiz, ivec2(p0.x, p1.y), level).x, texelFetch(u_hiz, p1, level).x));
+    return minDepth > maxDepth + DEPTH_BIAS;
+}
+
+void main(void) {
+    uint id = gl_GlobalInvocationID.x;
+    if (id >= u_numClusters) {
+        return;
+    }
+
+    Cluster cluster = clusters[id];
+    bool visible = insideFrustum(cluster.sphere);
+    if (visible && u_useHiZ != 0) {
+        visible = !occluded(cluster.sphere);
+    }
+
+    commands[id] = DrawCommand(cluster.count, visible ? 1u : 0u, cluster.firstIndex, 0, cluster.segment);
+}
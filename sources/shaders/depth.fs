@@ -0,0 +1,5 @@
+#version 450
+
+// Only the depth is written.
+void main(void) {
+}
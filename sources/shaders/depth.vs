@@ -0,0 +1,17 @@
+#version 450
+
+layout(location = 0) in vec3 in_position;
+
+uniform mat4 u_mvpMat;
+
+// Maps quantized positions back to the model space.
+uniform vec3 u_posScale = vec3(1.0);
+uniform vec3 u_posOffset = vec3(0.0);
+
+// Must be computed as in gbuffer.vs for the GL_EQUAL depth test.
+invariant gl_Position;
+
+void main(void) {
+    vec3 position = in_position * u_posScale + u_posOffset;
+    gl_Position = u_mvpMat * vec4(position, 1.0);
+}
@@ -6,7 +6,10 @@ layout(location = 2) in vec2 in_texcoord;
 
 out vec2 f_texcoord;
 
+// Part of the texture in use.
+uniform vec2 u_texScale = vec2(1.0);
+
 void main(void) {
     gl_Position = vec4(in_position, 1.0);
-    f_texcoord = in_texcoord;
+    f_texcoord = in_texcoord * u_texScale;
 }
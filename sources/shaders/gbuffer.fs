@@ -1,43 +1,74 @@
 #version 450
 
-layout(location = 0) in vec3 f_position;
-layout(location = 1) in vec3 f_normal;
-layout(location = 2) in vec2 f_texcoord;
-layout(location = 3) in float f_depth;
+layout(location = 0) in vec3 f_normal;
+layout(location = 1) in vec2 f_texcoord;
+layout(location = 2) flat in uint f_material;
 
-layout(location = 0) out vec4 out_position;
-layout(location = 1) out vec4 out_normal;
-layout(location = 2) out vec4 out_diffuse;
-layout(location = 3) out vec4 out_specular;
-layout(location = 4) out vec4 out_shininess;
+// Layout of GBuffer. Positions are reconstructed from the depth.
+layout(location = 0) out uvec2 out_normal;  // Octahedral normal and shininess.
+layout(location = 1) out vec4 out_albedo;   // Diffuse and specular intensity.
 
-uniform vec3 u_diffColor;
-uniform vec3 u_specColor;
+struct Material {
+    vec4 diffuse;     // Shininess in w.
+    vec4 specular;
+    ivec4 textures;   // Diffuse, specular and bump. (array << 16 | layer) or -1.
+};
 
-uniform sampler2D u_diffuseMap;
-uniform sampler2D u_specularMap;
-uniform sampler2D u_bumpMap;
-uniform float u_shininess;
+layout(std430, binding = 0) readonly buffer Materials {
+    Material materials[];
+};
 
-uniform bool u_hasDiffuseTex;
-uniform bool u_hasSpecularTex;
-uniform bool u_hasBumpTex;
+layout(binding = 10) uniform sampler2DArray u_textureArrays[8];
+
+vec4 sampleMaterialTexture(int tex, vec2 uv) {
+    return texture(u_textureArrays[tex >> 16], vec3(uv, float(tex & 0xffff)));
+}
+
+// HAS_DIFFUSE_TEX and HAS_SPECULAR_TEX are 1 or 0 in the programs of
+// ShaderPermutations, so the textures are tested at compile time. Otherwise,
+// they are tested per fragment.
+#ifdef HAS_DIFFUSE_TEX
+#define USE_DIFFUSE_TEX(m) bool(HAS_DIFFUSE_TEX)
+#else
+#define USE_DIFFUSE_TEX(m) (m.textures.x >= 0)
+#endif
+#ifdef HAS_SPECULAR_TEX
+#define USE_SPECULAR_TEX(m) bool(HAS_SPECULAR_TEX)
+#else
+#define USE_SPECULAR_TEX(m) (m.textures.y >= 0)
+#endif
+
+// Maps a unit vector to [0, 1]^2.
+vec2 encodeOctahedral(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * signs;
+    return e * 0.5 + 0.5;
+}
 
 void main(void) {
-    out_position = vec4(f_position, f_depth);
-    out_normal = vec4(f_normal, 1.0);
+    Material m = materials[f_material];
 
-    if (u_hasDiffuseTex) {
-        out_diffuse = texture(u_diffuseMap, f_texcoord);
+    vec3 diffuse;
+    if (USE_DIFFUSE_TEX(m)) {
+        diffuse = sampleMaterialTexture(m.textures.x, f_texcoord).rgb;
     } else {
-        out_diffuse = vec4(u_diffColor, 1.0);
+        diffuse = m.diffuse.rgb;
     }
 
-    if (u_hasSpecularTex) {
-        out_specular.rgb = texture(u_specularMap, f_texcoord).rgb;
+    vec3 specular;
+    if (USE_SPECULAR_TEX(m)) {
+        specular = sampleMaterialTexture(m.textures.y, f_texcoord).rgb;
     } else {
-        out_specular.rgb = u_specColor;
+        specular = m.specular.rgb;
     }
 
-    out_shininess = vec4(u_shininess, 1.0, 1.0, 1.0);
+    // 12 bits for each coordinate, and log2 of shininess in [0, 11] in 8 bits.
+    float len = length(f_normal);
+    vec3 normal = len > 0.0 ? f_normal / len : vec3(0.0, 0.0, 1.0);
+    uvec2 oct = uvec2(round(encodeOctahedral(normal) * 4095.0));
+    uint shininess = uint(round(clamp(log2(max(m.diffuse.w, 1.0)) / 11.0, 0.0, 1.0) * 255.0));
+    out_normal = (oct << 4) | uvec2(shininess >> 4, shininess & 15u);
+
+    out_albedo = vec4(diffuse, dot(specular, vec3(0.2126, 0.7152, 0.0722)));
 }
@@ -3,19 +3,26 @@
 layout(location = 0) in vec3 in_position;
 layout(location = 1) in vec3 in_normal;
 layout(location = 2) in vec2 in_texcoord;
+layout(location = 3) in uint in_material;  // Instanced, one per segment.
 
 uniform mat4 u_mvpMat;
 
-layout(location = 0) out vec3 f_position;
-layout(location = 1) out vec3 f_normal;
-layout(location = 2) out vec2 f_texcoord;
-layout(location = 3) out float f_depth;
+// Maps quantized positions back to the model space.
+uniform vec3 u_posScale = vec3(1.0);
+uniform vec3 u_posOffset = vec3(0.0);
+
+layout(location = 0) out vec3 f_normal;
+layout(location = 1) out vec2 f_texcoord;
+layout(location = 2) flat out uint f_material;
+
+// Must be computed as in depth.vs for the GL_EQUAL depth test.
+invariant gl_Position;
 
 void main(void) {
-    gl_Position = u_mvpMat * vec4(in_position, 1.0);
+    vec3 position = in_position * u_posScale + u_posOffset;
+    gl_Position = u_mvpMat * vec4(position, 1.0);
 
-    f_position = in_position;
     f_normal = in_normal;
     f_texcoord = in_texcoord;
-    f_depth = gl_Position.z / gl_Position.w;
+    f_material = in_material;
 }
@@ -0,0 +1,49 @@
+#version 450
+
+// Builds a level of the max-depth pyramid. Level 0 is read from the
+// depth of the G-buffer, taking the max of the samples if MULTISAMPLE is
+// defined.
+
+uniform int u_level;
+
+#ifdef MULTISAMPLE
+layout(binding = 0) uniform sampler2DMS u_depthMap;
+#else
+layout(binding = 0) uniform sampler2D u_depthMap;
+#endif
+layout(r32f, binding = 0) readonly uniform image2D u_src;
+layout(r32f, binding = 1) writeonly uniform image2D u_dst;
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+void main(void) {
+    ivec2 pixelPos = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(u_dst);
+    if (pixelPos.x >= size.x || pixelPos.y >= size.y) {
+        return;
+    }
+
+    float depth = 0.0;
+    if (u_level == 0) {
+#ifdef MULTISAMPLE
+        for (int s = 0; s < textureSamples(u_depthMap); s++) {
+            depth = max(depth, texelFetch(u_depthMap, pixelPos, s).x);
+        }
+#else
+        depth = texelFetch(u_depthMap, pixelPos, 0).x;
+#endif
+    } else {
+        // The last texel of an odd sized level also covers the remaining one.
+        ivec2 srcSize = imageSize(u_src);
+        ivec2 base = pixelPos * 2;
+        int nx = (pixelPos.x == size.x - 1 && (srcSize.x & 1) != 0) ? 3 : 2;
+        int ny = (pixelPos.y == size.y - 1 && (srcSize.y & 1) != 0) ? 3 : 2;
+        for (int y = 0; y < ny; y++) {
+            for (int x = 0; x < nx; x++) {
+                ivec2 p = min(base + ivec2(x, y), srcSize - 1);
+                depth = max(depth, imageLoad(u_src, p).x);
+            }
+        }
+    }
+    imageStore(u_dst, pixelPos, vec4(depth));
+}
@@ -6,29 +6,153 @@
 
 uniform mat4 u_mvMat;
 uniform mat4 u_normMat;
+uniform mat4 u_invProjMat;
 uniform vec3 u_lightPos;
+uniform vec2 u_gbufferSize;  // Part of the G-buffer in use.
+
+// The AA type, the subsample, the number of samples and the workgroup size
+// can be given as defines, so that loops are unrolled.
+#ifndef AA_TYPE
 uniform int u_aaType;
+#define AA_TYPE u_aaType
+#endif
+#ifndef SUBSAMPLE
 uniform int u_subsample;
+#define SUBSAMPLE u_subsample
+#endif
+#ifndef LOCAL_SIZE
+#define LOCAL_SIZE 32
+#endif
+
+// Layout of GBuffer. With MULTISAMPLE defined, it is multisampled at the
+// resolution of the render target, and only MSAA is done. With TILED
+// defined, each workgroup first loads the subpixels of its tile of
+// TILE_SIZE^2 pixels to shared memory, and SSAA or MSAA reads them from
+// there. SUBSAMPLE must not exceed MAX_SUBSAMPLE then. With EDGE_LIST
+// defined, MSAA is done in three passes chosen by u_pass, see main().
+#ifdef MULTISAMPLE
+layout(binding = 0) uniform sampler2DMS depthMap;
+layout(rg16ui, binding = 0) readonly uniform uimage2DMS normalMap;
+layout(rgba8, binding = 1) readonly uniform image2DMS albedoMap;
+#define LOAD_DEPTH(p, s) texelFetch(depthMap, p, s).x
+#define LOAD_NORMAL(p, s) imageLoad(normalMap, p, s).xy
+#define LOAD_ALBEDO(p, s) imageLoad(albedoMap, p, s)
+#ifndef NUM_SAMPLES
+#define NUM_SAMPLES textureSamples(depthMap)
+#endif
+#else
+layout(binding = 0) uniform sampler2D depthMap;
+layout(rg16ui, binding = 0) readonly uniform uimage2D normalMap;
+layout(rgba8, binding = 1) readonly uniform image2D albedoMap;
+#define FETCH_DEPTH(p) texelFetch(depthMap, p, 0).x
+#define FETCH_NORMAL(p) imageLoad(normalMap, p).xy
+#define FETCH_ALBEDO(p) imageLoad(albedoMap, p)
+#endif
+layout(rgba8_snorm, binding = 2) writeonly uniform image2D renderTarget;
+
+#if defined(TILED) && !defined(MULTISAMPLE)
+#define TILE_TEXELS (TILE_SIZE * MAX_SUBSAMPLE)
+shared float tileDepth[TILE_TEXELS * TILE_TEXELS];
+shared uint tileNormal[TILE_TEXELS * TILE_TEXELS];  // Two 16-bit channels.
+shared uint tileAlbedo[TILE_TEXELS * TILE_TEXELS];  // packUnorm4x8.
+shared bool tileEdge[TILE_SIZE * TILE_SIZE];
+
+ivec2 tileOrigin;  // First subpixel of the tile.
+
+int tileIndex(ivec2 p) {
+    ivec2 q = p - tileOrigin;
+    return q.y * TILE_TEXELS + q.x;
+}
+
+#define LOAD_DEPTH(p, s) tileDepth[tileIndex(p)]
+#define LOAD_NORMAL(p, s) uvec2(tileNormal[tileIndex(p)] & 0xffffu, tileNormal[tileIndex(p)] >> 16)
+#define LOAD_ALBEDO(p, s) unpackUnorm4x8(tileAlbedo[tileIndex(p)])
+
+layout(local_size_x = TILE_SIZE, local_size_y = TILE_SIZE) in;
+#elif defined(EDGE_LIST)
+#ifndef MULTISAMPLE
+#define LOAD_DEPTH(p, s) FETCH_DEPTH(p)
+#define LOAD_NORMAL(p, s) FETCH_NORMAL(p)
+#define LOAD_ALBEDO(p, s) FETCH_ALBEDO(p)
+#endif
 
-layout(rgba16f, binding = 0) readonly uniform image2D positionMap;
-layout(rgba16f, binding = 1) readonly uniform image2D normalMap;
-layout(rgba8_snorm, binding = 2) readonly uniform image2D diffuseMap;
-layout(rgba8_snorm, binding = 3) readonly uniform image2D specularMap;
-layout(r32f, binding = 4) readonly uniform image2D shininessMap;
-layout(rgba8_snorm, binding = 5) writeonly uniform image2D renderTarget;
+#define PASS_CLASSIFY 0
+#define PASS_INTERIOR 1
+#define PASS_EDGES 2
+#define PASS_ARGS 3
 
-layout(local_size_x = 32, local_size_y = 32) in;
+uniform int u_pass;
+uniform ivec2 u_targetSize;
+uniform uint u_maxGroupsX;  // GL_MAX_COMPUTE_WORK_GROUP_COUNT in x.
+
+// Interior pixels from the front and edge pixels from the back, packed
+// as (y << 16 | x).
+layout(std430, binding = 3) buffer PixelList {
+    uint pixelList[];
+};
+
+// Arguments of glDispatchComputeIndirect for the shading passes. Groups
+// wrap to rows of u_maxGroupsX, as a 4K target needs more than the 65535
+// groups guaranteed in x.
+layout(std430, binding = 4) buffer ResolveArgs {
+    uvec3 interiorGroups;
+    uint interiorCount;
+    uvec3 edgeGroups;
+    uint edgeCount;
+};
+
+layout(local_size_x = EDGE_LIST_LOCAL_SIZE) in;
+
+// Pixels of the workgroup in each list, and where they start in the list.
+shared uint groupInterior;
+shared uint groupEdge;
+shared uint baseInterior;
+shared uint baseEdge;
+
+// Groups of a shading pass over `count` list entries.
+uvec3 listGroups(uint count) {
+    uint n = (count + uint(EDGE_LIST_LOCAL_SIZE) - 1u) / uint(EDGE_LIST_LOCAL_SIZE);
+    return uvec3(min(n, u_maxGroupsX), (n + u_maxGroupsX - 1u) / u_maxGroupsX, 1u);
+}
+#else
+#ifndef MULTISAMPLE
+#define LOAD_DEPTH(p, s) FETCH_DEPTH(p)
+#define LOAD_NORMAL(p, s) FETCH_NORMAL(p)
+#define LOAD_ALBEDO(p, s) FETCH_ALBEDO(p)
+#endif
+
+layout(local_size_x = LOCAL_SIZE, local_size_y = LOCAL_SIZE) in;
+#endif
 
 float EPS = 1.0e-8;
 
-vec3 shading(ivec2 pixelPos) {
-    vec3 position = imageLoad(positionMap, pixelPos).xyz;
-    vec3 normal = imageLoad(normalMap, pixelPos).xyz;
-    vec3 diffuse = imageLoad(diffuseMap, pixelPos).xyz;
-    vec3 specular = imageLoad(specularMap, pixelPos).xyz;
-    float shininess = imageLoad(shininessMap, pixelPos).x;
+vec3 decodeOctahedral(vec2 e) {
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        n.xy = (1.0 - abs(n.yx)) * signs;
+    }
+    return normalize(n);
+}
+
+// Sample positions are not known here, so the position of a sample is
+// reconstructed at the center of its pixel.
+vec3 shading(ivec2 pixelPos, int sampleId) {
+    float depth = LOAD_DEPTH(pixelPos, sampleId);
+    uvec2 packedNormal = LOAD_NORMAL(pixelPos, sampleId);
+    vec4 albedo = LOAD_ALBEDO(pixelPos, sampleId);
+
+    vec2 uv = (vec2(pixelPos) + 0.5) / u_gbufferSize;
+    vec4 ndc = u_invProjMat * vec4(uv * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec3 posView = ndc.xyz / ndc.w;
+
+    vec3 normal = decodeOctahedral(vec2(packedNormal >> 4) / 4095.0);
+    uint shininessBits = ((packedNormal.x & 15u) << 4) | (packedNormal.y & 15u);
+    float shininess = exp2(float(shininessBits) / 255.0 * 11.0);
+    vec3 diffuse = albedo.rgb;
+    vec3 specular = vec3(albedo.a);
 
-    vec3 posView = (u_mvMat * vec4(position, 1.0)).xyz;
     vec3 normView = (u_normMat * vec4(normal, 0.0)).xyz;
     vec3 lightPosView = (u_mvMat * vec4(u_lightPos, 1.0)).xyz;
 
@@ -44,28 +168,55 @@ vec3 shading(ivec2 pixelPos) {
     return rgb;
 }
 
+#ifdef MULTISAMPLE
+bool isEdgePixel(ivec2 pixelPos) {
+    // Fragments are shaded once per pixel, so samples of the same primitive
+    // hold the same normal and albedo, while their depths differ.
+    int numSamples = NUM_SAMPLES;
+    uvec2 normal0 = LOAD_NORMAL(pixelPos, 0);
+    vec4 albedo0 = LOAD_ALBEDO(pixelPos, 0);
+    for (int s = 1; s < numSamples; s++) {
+        if (LOAD_NORMAL(pixelPos, s) != normal0 || LOAD_ALBEDO(pixelPos, s) != albedo0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+vec3 shadingInterior(ivec2 pixelPos) {
+    return shading(pixelPos, 0);
+}
+
+vec3 shadingEdge(ivec2 pixelPos) {
+    int numSamples = NUM_SAMPLES;
+    vec3 rgb = vec3(0.0, 0.0, 0.0);
+    for (int s = 0; s < numSamples; s++) {
+        rgb += shading(pixelPos, s);
+    }
+    return rgb / numSamples;
+}
+#else
 vec3 shadingSSAA(ivec2 pixelPos) {
     vec3 rgb = vec3(0.0, 0.0, 0.0);
-    for (int i = 0; i < u_subsample; i++) {
-        for (int j = 0; j < u_subsample; j++) {
-            ivec2 subpixel = pixelPos * u_subsample + ivec2(i, j);
-            rgb += shading(subpixel);
+    for (int i = 0; i < SUBSAMPLE; i++) {
+        for (int j = 0; j < SUBSAMPLE; j++) {
+            ivec2 subpixel = pixelPos * SUBSAMPLE + ivec2(i, j);
+            rgb += shading(subpixel, 0);
         }
     }
-    rgb /= (u_subsample * u_subsample);
+    rgb /= (SUBSAMPLE * SUBSAMPLE);
 
     return rgb;
 }
 
-vec3 shadingMSAA(ivec2 pixelPos) {
-    // Edge test
-    float zValue = imageLoad(positionMap, pixelPos * u_subsample).w;
+bool isEdgePixel(ivec2 pixelPos) {
+    float zValue = LOAD_DEPTH(pixelPos * SUBSAMPLE, 0);
     bool isEdge = false;
-    for (int i = 0; i < u_subsample; i++) {
-        for (int j = 0; j < u_subsample; j++) {
-            ivec2 subpixel = pixelPos * u_subsample + ivec2(i, j);
-            float zSub = imageLoad(positionMap, subpixel).w;
-            if (abs(zValue - zSub) > 1.0e-4) {
+    for (int i = 0; i < SUBSAMPLE; i++) {
+        for (int j = 0; j < SUBSAMPLE; j++) {
+            ivec2 subpixel = pixelPos * SUBSAMPLE + ivec2(i, j);
+            float zSub = LOAD_DEPTH(subpixel, 0);
+            if (abs(zValue - zSub) > 5.0e-5) {
                 isEdge = true;
                 break;
             }
@@ -75,26 +226,146 @@ vec3 shadingMSAA(ivec2 pixelPos) {
             break;
         }
     }
+    return isEdge;
+}
 
-    // Shading
-    if (isEdge) {
-        return shadingSSAA(pixelPos);
+vec3 shadingInterior(ivec2 pixelPos) {
+    return shading(pixelPos * SUBSAMPLE, 0);
+}
+
+vec3 shadingEdge(ivec2 pixelPos) {
+    return shadingSSAA(pixelPos);
+}
+#endif
+
+vec3 shadingMSAA(ivec2 pixelPos) {
+    if (isEdgePixel(pixelPos)) {
+        return shadingEdge(pixelPos);
     } else {
-        return shading(pixelPos * u_subsample);
+        return shadingInterior(pixelPos);
+    }
+}
+
+#if defined(TILED) && !defined(MULTISAMPLE)
+// Loads the depth of all the subpixels of the tile, then the rest of those
+// to be shaded, i.e., all for SSAA, and all of edge pixels or the first of
+// others for MSAA.
+void loadTile() {
+    int span = TILE_SIZE * SUBSAMPLE;
+    const int numThreads = TILE_SIZE * TILE_SIZE;
+    int lane = int(gl_LocalInvocationIndex);
+    tileOrigin = ivec2(gl_WorkGroupID.xy) * span;
+
+    for (int i = lane; i < span * span; i += numThreads) {
+        ivec2 q = ivec2(i % span, i / span);
+        tileDepth[q.y * TILE_TEXELS + q.x] = FETCH_DEPTH(tileOrigin + q);
     }
+    barrier();
+
+    tileEdge[lane] = AA_TYPE == AA_TYPE_SSAA || isEdgePixel(ivec2(gl_GlobalInvocationID.xy));
+    barrier();
+
+    for (int i = lane; i < span * span; i += numThreads) {
+        ivec2 q = ivec2(i % span, i / span);
+        ivec2 pixel = q / SUBSAMPLE;
+        bool first = all(equal(q, pixel * SUBSAMPLE));
+        if (first || tileEdge[pixel.y * TILE_SIZE + pixel.x]) {
+            uvec2 normal = FETCH_NORMAL(tileOrigin + q);
+            tileNormal[q.y * TILE_TEXELS + q.x] = normal.x | (normal.y << 16);
+            tileAlbedo[q.y * TILE_TEXELS + q.x] = packUnorm4x8(FETCH_ALBEDO(tileOrigin + q));
+        }
+    }
+    barrier();
 }
+#endif
 
+#ifdef EDGE_LIST
+// Each pass runs over a list, so all the lanes of a shading pass do the same
+// work. The classification pass fills the lists, and a single invocation
+// then writes the dispatch arguments.
+void main(void) {
+    uint group = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+    uint id = group * uint(EDGE_LIST_LOCAL_SIZE) + gl_LocalInvocationIndex;
+    uint numPixels = uint(u_targetSize.x * u_targetSize.y);
+
+    if (u_pass == PASS_CLASSIFY) {
+        // Pixels are counted in shared memory, so each workgroup takes one
+        // global atomic per list. Lanes past the target stay for the barriers.
+        if (gl_LocalInvocationIndex == 0u) {
+            groupInterior = 0u;
+            groupEdge = 0u;
+        }
+        barrier();
+
+        bool valid = id < numPixels;
+        ivec2 pixelPos = ivec2(id % uint(u_targetSize.x), id / uint(u_targetSize.x));
+        bool edge = valid && isEdgePixel(pixelPos);
+        uint local = 0u;
+        if (valid) {
+            local = edge ? atomicAdd(groupEdge, 1u) : atomicAdd(groupInterior, 1u);
+        }
+        barrier();
+
+        if (gl_LocalInvocationIndex == 0u) {
+            baseInterior = atomicAdd(interiorCount, groupInterior);
+            baseEdge = atomicAdd(edgeCount, groupEdge);
+        }
+        barrier();
+
+        if (valid) {
+            uint packedPos = (uint(pixelPos.y) << 16) | uint(pixelPos.x);
+            if (edge) {
+                pixelList[numPixels - 1u - (baseEdge + local)] = packedPos;
+            } else {
+                pixelList[baseInterior + local] = packedPos;
+            }
+        }
+    } else if (u_pass == PASS_ARGS) {
+        interiorGroups = listGroups(interiorCount);
+        edgeGroups = listGroups(edgeCount);
+    } else if (u_pass == PASS_INTERIOR) {
+        if (id >= interiorCount) {
+            return;
+        }
+
+        uint packedPos = pixelList[id];
+        ivec2 pixelPos = ivec2(packedPos & 0xffffu, packedPos >> 16);
+        imageStore(renderTarget, pixelPos, vec4(shadingInterior(pixelPos), 1.0));
+    } else if (u_pass == PASS_EDGES) {
+        if (id >= edgeCount) {
+            return;
+        }
+
+        uint packedPos = pixelList[numPixels - 1u - id];
+        ivec2 pixelPos = ivec2(packedPos & 0xffffu, packedPos >> 16);
+        imageStore(renderTarget, pixelPos, vec4(shadingEdge(pixelPos), 1.0));
+    }
+}
+#else
 void main(void) {
     ivec2 pixelPos = ivec2(gl_GlobalInvocationID.xy);
 
     // Visibility test
     vec3 rgb;
-    if (u_aaType == AA_TYPE_NONE) {
-        rgb = shading(pixelPos * u_subsample);
-    } else if (u_aaType == AA_TYPE_SSAA) {
+#if defined(MULTISAMPLE)
+    rgb = shadingMSAA(pixelPos);
+#elif defined(TILED)
+    // Not used for AA_TYPE_NONE, which reads one subpixel per pixel.
+    loadTile();
+    if (tileEdge[gl_LocalInvocationIndex]) {
+        rgb = shadingSSAA(pixelPos);
+    } else {
+        rgb = shading(pixelPos * SUBSAMPLE, 0);
+    }
+#else
+    if (AA_TYPE == AA_TYPE_NONE) {
+        rgb = shading(pixelPos * SUBSAMPLE, 0);
+    } else if (AA_TYPE == AA_TYPE_SSAA) {
         rgb = shadingSSAA(pixelPos);
-    } else if (u_aaType == AA_TYPE_MSAA) {
+    } else if (AA_TYPE == AA_TYPE_MSAA) {
         rgb = shadingMSAA(pixelPos);
     }
+#endif
     imageStore(renderTarget, pixelPos, vec4(rgb, 1.0));
 }
+#endif
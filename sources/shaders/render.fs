@@ -1,23 +1,42 @@
-#version 410
+#version 450
 
 in vec3 f_posView;
 in vec3 f_normView;
 in vec2 f_texcoord;
 in vec3 f_lightPos;
+flat in uint f_material;
 
 out vec4 out_color;
 
-uniform vec3 u_diffColor;
-uniform vec3 u_specColor;
+struct Material {
+    vec4 diffuse;     // Shininess in w.
+    vec4 specular;
+    ivec4 textures;   // Diffuse, specular and bump. (array << 16 | layer) or -1.
+};
 
-uniform sampler2D u_diffuseMap;
-uniform sampler2D u_specularMap;
-uniform sampler2D u_bumpMap;
-uniform float u_shininess;
+layout(std430, binding = 0) readonly buffer Materials {
+    Material materials[];
+};
 
-uniform bool u_hasDiffuseTex;
-uniform bool u_hasSpecularTex;
-uniform bool u_hasBumpTex;
+layout(binding = 10) uniform sampler2DArray u_textureArrays[8];
+
+vec4 sampleMaterialTexture(int tex, vec2 uv) {
+    return texture(u_textureArrays[tex >> 16], vec3(uv, float(tex & 0xffff)));
+}
+
+// HAS_DIFFUSE_TEX and HAS_SPECULAR_TEX are 1 or 0 in the programs of
+// ShaderPermutations, so the textures are tested at compile time. Otherwise,
+// they are tested per fragment.
+#ifdef HAS_DIFFUSE_TEX
+#define USE_DIFFUSE_TEX(m) bool(HAS_DIFFUSE_TEX)
+#else
+#define USE_DIFFUSE_TEX(m) (m.textures.x >= 0)
+#endif
+#ifdef HAS_SPECULAR_TEX
+#define USE_SPECULAR_TEX(m) bool(HAS_SPECULAR_TEX)
+#else
+#define USE_SPECULAR_TEX(m) (m.textures.y >= 0)
+#endif
 
 float EPS = 1.0e-8;
 
@@ -30,16 +49,18 @@ void main(void) {
     float ndotl = max(0.0, dot(N, L));
     float ndoth = max(0.0, dot(N, H));
 
-    vec3 diffColor = u_diffColor;
-    if (u_hasDiffuseTex) {
-        diffColor = texture(u_diffuseMap, f_texcoord).rgb;
+    Material m = materials[f_material];
+
+    vec3 diffColor = m.diffuse.rgb;
+    if (USE_DIFFUSE_TEX(m)) {
+        diffColor = sampleMaterialTexture(m.textures.x, f_texcoord).rgb;
     }
 
-    vec3 specColor = u_specColor;
-    if (u_hasSpecularTex) {
-        specColor = texture(u_specularMap, f_texcoord).rgb;
+    vec3 specColor = m.specular.rgb;
+    if (USE_SPECULAR_TEX(m)) {
+        specColor = sampleMaterialTexture(m.textures.y, f_texcoord).rgb;
     }
 
-    out_color.rgb = diffColor * ndotl + specColor * pow(ndoth + EPS, u_shininess);
+    out_color.rgb = diffColor * ndotl + specColor * pow(ndoth + EPS, m.diffuse.w);
     out_color.a   = 1.0;
 }
@@ -1,23 +1,31 @@
-#version 410
+#version 450
 
 layout(location = 0) in vec3 in_position;
 layout(location = 1) in vec3 in_normal;
 layout(location = 2) in vec2 in_texcoord;
+layout(location = 3) in uint in_material;  // Instanced, one per segment.
 
 out vec3 f_posView;
 out vec3 f_normView;
 out vec2 f_texcoord;
 out vec3 f_lightPos;
+flat out uint f_material;
 
 uniform mat4 u_mvMat;
 uniform mat4 u_mvpMat;
 uniform mat4 u_normMat;
 uniform vec3 u_lightPos;
 
+// Maps quantized positions back to the model space.
+uniform vec3 u_posScale = vec3(1.0);
+uniform vec3 u_posOffset = vec3(0.0);
+
 void main(void) {
-    gl_Position = u_mvpMat * vec4(in_position, 1.0);
-    f_posView = (u_mvMat * vec4(in_position, 1.0)).xyz;
+    vec3 position = in_position * u_posScale + u_posOffset;
+    gl_Position = u_mvpMat * vec4(position, 1.0);
+    f_posView = (u_mvMat * vec4(position, 1.0)).xyz;
     f_normView = (u_normMat * vec4(in_normal, 0.0)).xyz;
     f_texcoord = in_texcoord;
     f_lightPos = (u_mvMat * vec4(u_lightPos, 1.0)).xyz;
+    f_material = in_material;
 }
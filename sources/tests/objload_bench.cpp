@@ -0,0 +1,126 @@
+// Measures the load time and peak RSS of tinyobj::LoadObj, e.g., before and
+// after a change to the parser. Without a file, a grid of n x n quads is
+// written to a temporary .obj and loaded instead.
+// Usage: objload_bench <file.obj> [repeats]
+//        objload_bench --grid <n> [repeats]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+namespace {
+
+double peakRssMB() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0.0;
+    }
+    return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0);  // Bytes
+#else
+    return usage.ru_maxrss / 1024.0;  // Kilobytes
+#endif
+#endif
+}
+
+bool writeGrid(const std::string &filename, int n) {
+    FILE *fp = fopen(filename.c_str(), "w");
+    if (!fp) {
+        return false;
+    }
+
+    for (int y = 0; y <= n; y++) {
+        for (int x = 0; x <= n; x++) {
+            fprintf(fp, "v %.6f %.6f 0.000000\n", (float)x / n, (float)y / n);
+            fprintf(fp, "vt %.6f %.6f\n", (float)x / n, (float)y / n);
+        }
+    }
+    fprintf(fp, "vn 0.000000 0.000000 1.000000\n");
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            const int i = y * (n + 1) + x + 1;
+            fprintf(fp, "f %d/%d/1 %d/%d/1 %d/%d/1 %d/%d/1\n",
+                    i, i, i + 1, i + 1, i + n + 2, i + n + 2, i + n + 1, i + n + 1);
+        }
+    }
+    return fclose(fp) == 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    if (argc < 2 || (strcmp(argv[1], "--grid") == 0 && argc < 3)) {
+        fprintf(stderr, "usage: %s <file.obj> [repeats]\n", argv[0]);
+        fprintf(stderr, "       %s --grid <n> [repeats]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::string filename = argv[1];
+    int next = 2;
+    bool grid = false;
+    if (filename == "--grid") {
+        const int n = atoi(argv[2]);
+        filename = "objload_bench_grid.obj";
+        if (n <= 0 || !writeGrid(filename, n)) {
+            fprintf(stderr, "[ERROR] failed to write %s\n", filename.c_str());
+            return EXIT_FAILURE;
+        }
+        grid = true;
+        next = 3;
+    }
+    const int repeats = argc > next ? std::max(atoi(argv[next]), 1) : 3;
+
+    std::vector<double> times;
+    size_t numIndices = 0;
+    for (int r = 0; r < repeats; r++) {
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+        std::string err;
+
+        const auto start = std::chrono::steady_clock::now();
+        const bool success = tinyobj::LoadObj(shapes, materials, err, filename.c_str());
+        const auto end = std::chrono::steady_clock::now();
+        if (!success) {
+            fprintf(stderr, "[ERROR] %s\n", err.c_str());
+            return EXIT_FAILURE;
+        }
+
+        times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        numIndices = 0;
+        for (const auto &shape : shapes) {
+            numIndices += shape.mesh.indices.size();
+        }
+    }
+
+    if (grid) {
+        remove(filename.c_str());
+    }
+
+    std::sort(times.begin(), times.end());
+    printf("[INFO] %s: %zu indices\n", filename.c_str(), numIndices);
+    printf("[INFO] load: %.1f ms (min), %.1f ms (median) of %d\n", times.front(), times[times.size() / 2], repeats);
+    printf("[INFO] peak RSS: %.1f MB\n", peakRssMB());
+    return EXIT_SUCCESS;
+}
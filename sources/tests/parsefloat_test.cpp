@@ -0,0 +1,89 @@
+// Compares the float parsers of tiny_obj_loader.h with strtod on random
+// numbers. The fixed-format fast path must match strtod exactly, while the
+// general parser, which tryParseDouble falls back to, may be a few ulps off.
+// Usage: parsefloat_test [count] [seed]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <random>
+#include <string>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+namespace {
+
+const double kTolerance = 1.0e-12;  // Relative, for the general parser.
+
+std::string randomDigits(std::mt19937_64 &rng, int count) {
+    std::string digits;
+    for (int i = 0; i < count; i++) {
+        digits += (char)('0' + rng() % 10);
+    }
+    return digits;
+}
+
+// Numbers as .obj exporters write them, with an exponent once in a while.
+std::string randomNumber(std::mt19937_64 &rng) {
+    std::string s;
+    switch (rng() % 3) {
+    case 0: s += '-'; break;
+    case 1: s += '+'; break;
+    default: break;
+    }
+    s += randomDigits(rng, 1 + (int)(rng() % 8));
+    if (rng() % 8 != 0) {
+        s += '.';
+        s += randomDigits(rng, 1 + (int)(rng() % 12));
+    }
+    if (rng() % 8 == 0) {
+        s += (rng() % 2) ? 'e' : 'E';
+        s += (rng() % 2) ? "-" : "+";
+        s += randomDigits(rng, 1 + (int)(rng() % 2));
+    }
+    return s;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    const long count = argc > 1 ? atol(argv[1]) : 1000000;
+    const unsigned long long seed = argc > 2 ? strtoull(argv[2], nullptr, 10) : 5489ull;
+    std::mt19937_64 rng(seed);
+
+    long fixed = 0, failures = 0;
+    double maxError = 0.0;
+    for (long i = 0; i < count; i++) {
+        const std::string s = randomNumber(rng);
+        const char *begin = s.c_str();
+        const char *end = begin + s.size();
+        const double expected = strtod(begin, nullptr);
+
+        double value = 0.0;
+        if (tinyobj::tryParseFixedDouble(begin, end, &value)) {
+            fixed++;
+            if (value != expected) {
+                printf("[ERROR] tryParseFixedDouble(\"%s\") = %.17g, strtod = %.17g\n", begin, value, expected);
+                failures++;
+            }
+        }
+
+        if (!tinyobj::tryParseDouble(begin, end, &value)) {
+            printf("[ERROR] tryParseDouble(\"%s\") failed\n", begin);
+            failures++;
+            continue;
+        }
+        const double error = expected != 0.0 ? std::abs(value - expected) / std::abs(expected) : std::abs(value);
+        maxError = std::max(maxError, error);
+        if (error > kTolerance) {
+            printf("[ERROR] tryParseDouble(\"%s\") = %.17g, strtod = %.17g\n", begin, value, expected);
+            failures++;
+        }
+    }
+
+    printf("[INFO] %ld numbers (seed %llu), %ld by the fixed-format path\n", count, seed, fixed);
+    printf("[INFO] max relative error of tryParseDouble: %g\n", maxError);
+    printf("[INFO] %ld failures\n", failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
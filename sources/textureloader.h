@@ -0,0 +1,154 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _TEXTURELOADER_H_
+#define _TEXTURELOADER_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <QtCore/qfileinfo.h>
+#include <QtGui/qimage.h>
+
+/**
+ * Decodes image files on worker threads.
+ * @details
+ * request() queues a file and returns at once, so images are decoded while
+ * the caller does something else, e.g., parsing the OBJ file. take() waits
+ * for the image. Only decoding runs on the workers, so the GL upload must be
+ * done by the caller on the thread of the OpenGL context.
+ * Paths are made canonical, so a file is decoded once however it is named.
+ **/
+class TextureLoader {
+public:
+    explicit TextureLoader(int numThreads = 0) {
+        if (numThreads <= 0) {
+            numThreads = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+        }
+        numThreads_ = numThreads;
+    }
+
+    TextureLoader(const TextureLoader &) = delete;
+    TextureLoader & operator=(const TextureLoader &) = delete;
+
+    virtual ~TextureLoader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+            queue_.clear();
+        }
+        cond_.notify_all();
+
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+    }
+
+    //! Canonical form of `path`, or the absolute one if the file does not exist.
+    static std::string canonicalPath(const std::string &path) {
+        QFileInfo info(QString::fromStdString(path));
+        QString canonical = info.canonicalFilePath();
+        if (canonical.isEmpty()) {
+            canonical = info.absoluteFilePath();
+        }
+        return canonical.toStdString();
+    }
+
+    //! Queues `path` to be decoded unless it has been requested already.
+    void request(const std::string &filename) {
+        if (filename.empty()) {
+            return;
+        }
+
+        const std::string path = canonicalPath(filename);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (entries_.count(path) != 0) {
+                return;
+            }
+            entries_[path] = Entry();
+            queue_.push_back(path);
+
+            if (workers_.size() < numThreads_) {
+                workers_.emplace_back([this]() { run(); });
+            }
+        }
+        cond_.notify_all();
+    }
+
+    //! Waits until `path` is decoded and returns the image. It is requested
+    //! first if needed. A null image is returned when decoding failed.
+    QImage take(const std::string &filename) {
+        if (filename.empty()) {
+            return QImage();
+        }
+        request(filename);
+
+        const std::string path = canonicalPath(filename);
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [&]() {
+            return entries_[path].done;
+        });
+        return entries_[path].image;
+    }
+
+    //! Waits for all requests and releases the decoded images.
+    void clear() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this]() {
+            return queue_.empty() && numRunning_ == 0;
+        });
+        entries_.clear();
+    }
+
+private:
+    struct Entry {
+        QImage image;
+        bool done = false;
+    };
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            cond_.wait(lock, [this]() {
+                return closed_ || !queue_.empty();
+            });
+            if (closed_) {
+                break;
+            }
+
+            const std::string path = queue_.front();
+            queue_.pop_front();
+            numRunning_++;
+
+            lock.unlock();
+            QImage image;
+            image.load(QString::fromStdString(path));
+            lock.lock();
+
+            auto &entry = entries_[path];
+            entry.image = image;
+            entry.done = true;
+            numRunning_--;
+            cond_.notify_all();
+        }
+    }
+
+    size_t numThreads_ = 1;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::string> queue_;
+    std::map<std::string, Entry> entries_;
+    int numRunning_ = 0;
+    bool closed_ = false;
+};
+
+#endif  // _TEXTURELOADER_H_
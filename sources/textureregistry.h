@@ -0,0 +1,92 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _TEXTUREREGISTRY_H_
+#define _TEXTUREREGISTRY_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "imagetexture.h"
+#include "textureloader.h"
+
+/**
+ * Textures shared by the materials of a scene.
+ * @details
+ * Textures are keyed by the canonical path of the image file, so a file
+ * referenced by many materials is decoded and uploaded to GPU only once.
+ * Textures are created on the calling thread, which must own the OpenGL
+ * context.
+ **/
+class TextureRegistry {
+public:
+    struct Stats {
+        int uploads = 0;        //! Textures created.
+        int hits = 0;           //! Requests served by an existing texture.
+        uint64_t bytes = 0;     //! Size of the created textures, as RGBA8.
+        uint64_t bytesSaved = 0;
+    };
+
+    explicit TextureRegistry(TextureLoader &loader)
+        : loader_(loader) {
+    }
+
+    TextureRegistry(const TextureRegistry &) = delete;
+    TextureRegistry & operator=(const TextureRegistry &) = delete;
+
+    virtual ~TextureRegistry() {
+    }
+
+    //! Returns the texture of `filename`. `decoded` is set to false when the
+    //! file could not be decoded, in which case the texture is empty.
+    std::shared_ptr<ImageTexture> get(const std::string &filename, bool *decoded = nullptr) {
+        const std::string path = TextureLoader::canonicalPath(filename);
+
+        auto it = entries_.find(path);
+        if (it != entries_.end()) {
+            stats_.hits += 1;
+            stats_.bytesSaved += it->second.bytes;
+            if (decoded) *decoded = it->second.decoded;
+            return it->second.texture;
+        }
+
+        Entry entry;
+        QImage img = loader_.take(path);
+        entry.decoded = !img.isNull();
+        entry.bytes = (uint64_t)img.width() * img.height() * 4;
+        entry.texture = std::make_shared<ImageTexture>(img);
+        entries_[path] = entry;
+
+        stats_.uploads += 1;
+        stats_.bytes += entry.bytes;
+        if (decoded) *decoded = entry.decoded;
+        return entry.texture;
+    }
+
+    //! Drops the textures and the stats. Textures still used by materials
+    //! are kept alive by them.
+    void clear() {
+        entries_.clear();
+        stats_ = Stats();
+    }
+
+    const Stats & stats() const {
+        return stats_;
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<ImageTexture> texture = nullptr;
+        uint64_t bytes = 0;
+        bool decoded = false;
+    };
+
+    TextureLoader &loader_;
+    std::map<std::string, Entry> entries_;
+    Stats stats_;
+};
+
+#endif  // _TEXTUREREGISTRY_H_
@@ -5,6 +5,11 @@
 //
 
 //
+// version 0.9.26: Add streaming LoadObj which emits shapes while parsing.
+// version 0.9.25: Add a fast path for fixed-format floats to tryParseDouble.
+// version 0.9.24: Parse .obj and .mtl files directly from memory mapping.
+// version 0.9.23: Add chunked multithreaded parsing(`parallel_parsing`) and
+//                 loading from a memory buffer.
 // version 0.9.22: Introduce `load_flags_t`.
 // version 0.9.20: Fixes creating per-face material using `usemtl`(#68)
 // version 0.9.17: Support n-polygon and crease tag(OpenSubdiv extension)
@@ -103,6 +108,7 @@ typedef enum
 {
   triangulation = 1,        // used whether triangulate polygon face in .obj
   calculate_normals = 2,    // used whether calculate the normals if the .obj normals are empty
+  parallel_parsing = 4,     // used whether split the .obj into chunks parsed on multiple threads
   // Some nice stuff here
 } load_flags_t;
 
@@ -186,7 +192,21 @@ private:
   std::string m_mtlBasePath;
 };
 
+class ShapeCallback {
+public:
+  ShapeCallback() {}
+  virtual ~ShapeCallback();
+
+  /// Called for every shape of the streaming LoadObj.
+  /// `materials` holds the materials read so far.
+  /// Returns false to abort loading.
+  virtual bool operator()(const shape_t &shape,
+                          const std::vector<material_t> &materials) = 0;
+};
+
 /// Loads .obj from a file.
+/// The file is memory-mapped and parsed in place when the platform allows,
+/// otherwise it is read through std::ifstream.
 /// 'shapes' will be filled with parsed shape data
 /// The function returns error string.
 /// Returns true when loading .obj become success.
@@ -199,6 +219,29 @@ bool LoadObj(std::vector<shape_t> &shapes,       // [output]
              const char *filename, const char *mtl_basepath = NULL,
              unsigned int flags = 1 );
 
+/// Loads .obj from a file, uses `readMatFn` to retrieve materials.
+/// Otherwise the same as the overload above.
+bool LoadObj(std::vector<shape_t> &shapes,       // [output]
+             std::vector<material_t> &materials, // [output]
+             std::string &err,                   // [output]
+             const char *filename, MaterialReader &readMatFn,
+             unsigned int flags = 1);
+
+/// Loads .obj from a file and passes the shapes to `shapeFn` while parsing
+/// instead of returning them at the end. A shape is emitted for every face
+/// group, i.e., when the group, the object or the material changes, and a
+/// face group is split after `max_faces` faces. Emitted shapes are not kept,
+/// so the output held at once is bounded by `max_faces`. Vertex attributes
+/// are kept for the whole file, since a face may refer to any of them.
+/// `parallel_parsing` is ignored.
+/// Returns true when loading .obj become success.
+/// Returns warning and error message into `err`
+bool LoadObj(std::vector<material_t> &materials, // [output]
+             std::string &err,                   // [output]
+             const char *filename, MaterialReader &readMatFn,
+             ShapeCallback &shapeFn, size_t max_faces = 65536,
+             unsigned int flags = 1);
+
 /// Loads object from a std::istream, uses GetMtlIStreamFn to retrieve
 /// std::istream for materials.
 /// Returns true when loading .obj become success.
@@ -209,10 +252,29 @@ bool LoadObj(std::vector<shape_t> &shapes,       // [output]
              std::istream &inStream, MaterialReader &readMatFn,
              unsigned int flags = 1);
 
+/// Loads object from a memory buffer of `length` bytes, uses `readMatFn` to
+/// retrieve materials. The buffer need not be NUL-terminated.
+/// When `parallel_parsing` is set in `flags`, the buffer is split into
+/// newline-aligned chunks which are parsed on worker threads, then merged.
+/// The output is identical to the one of the sequential parser.
+/// Returns true when loading .obj become success.
+/// Returns warning and error message into `err`
+bool LoadObj(std::vector<shape_t> &shapes,       // [output]
+             std::vector<material_t> &materials, // [output]
+             std::string &err,                   // [output]
+             const char *buffer, size_t length, MaterialReader &readMatFn,
+             unsigned int flags = 1);
+
 /// Loads materials into std::map
 void LoadMtl(std::map<std::string, int> &material_map, // [output]
              std::vector<material_t> &materials,       // [output]
              std::istream &inStream);
+
+/// Loads materials into std::map from a memory buffer of `length` bytes.
+/// The buffer need not be NUL-terminated.
+void LoadMtl(std::map<std::string, int> &material_map, // [output]
+             std::vector<material_t> &materials,       // [output]
+             const char *buffer, size_t length);
 }
 
 #ifdef TINYOBJLOADER_IMPLEMENTATION
@@ -223,14 +285,33 @@ void LoadMtl(std::map<std::string, int> &material_map, // [output]
 #include <cstddef>
 #include <cctype>
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "tiny_obj_loader.h"
 
 namespace tinyobj {
 
 MaterialReader::~MaterialReader() {}
+ShapeCallback::~ShapeCallback() {}
 
 #define TINYOBJ_SSCANF_BUFFER_SIZE (4096)
 
@@ -249,17 +330,83 @@ struct tag_sizes {
   int num_strings;
 };
 
-// for std::map
-static inline bool operator<(const vertex_index &a, const vertex_index &b) {
-  if (a.v_idx != b.v_idx)
-    return (a.v_idx < b.v_idx);
-  if (a.vn_idx != b.vn_idx)
-    return (a.vn_idx < b.vn_idx);
-  if (a.vt_idx != b.vt_idx)
-    return (a.vt_idx < b.vt_idx);
+// Open-addressing hash table from vertex_index to the index of the vertex
+// in the shape, used to share vertices between faces. Entries are stored
+// flat with linear probing, and the load factor is kept under 1/2.
+class vertex_cache {
+public:
+  vertex_cache() : size_(0) {}
+
+  // Makes room for `n` vertices without rehashing.
+  void reserve(size_t n) {
+    size_t capacity = 16;
+    while (capacity < 2 * n)
+      capacity *= 2;
+    if (capacity > entries_.size())
+      rehash(capacity);
+  }
 
-  return false;
-}
+  // Releases the table, as a cache is rarely reused for a same-sized shape.
+  void clear() {
+    std::vector<entry>().swap(entries_);
+    size_ = 0;
+  }
+
+  // Returns the value for `key`. If `key` is not found, `value` is inserted
+  // and returned.
+  unsigned int insert(const vertex_index &key, unsigned int value) {
+    if (2 * (size_ + 1) > entries_.size())
+      rehash(std::max(static_cast<size_t>(16), 2 * entries_.size()));
+
+    const size_t mask = entries_.size() - 1;
+    for (size_t pos = hash(key) & mask;; pos = (pos + 1) & mask) {
+      entry &e = entries_[pos];
+      if (e.value == kEmpty) {
+        e.key = key;
+        e.value = value;
+        size_++;
+        return value;
+      }
+      if (e.key.v_idx == key.v_idx && e.key.vt_idx == key.vt_idx &&
+          e.key.vn_idx == key.vn_idx)
+        return e.value;
+    }
+  }
+
+private:
+  static const unsigned int kEmpty = 0xffffffffu;
+
+  struct entry {
+    entry() : value(kEmpty) {}
+    vertex_index key;
+    unsigned int value;
+  };
+
+  static size_t hash(const vertex_index &vi) {
+    const unsigned long long k = 0x9E3779B97F4A7C15ull;
+    unsigned long long h = static_cast<unsigned int>(vi.v_idx);
+    h = (h * k) ^ static_cast<unsigned int>(vi.vt_idx);
+    h = (h * k) ^ static_cast<unsigned int>(vi.vn_idx);
+    return static_cast<size_t>((h * k) >> 32);
+  }
+
+  void rehash(size_t capacity) {
+    std::vector<entry> old(capacity);
+    old.swap(entries_);
+    const size_t mask = capacity - 1;
+    for (size_t i = 0; i < old.size(); i++) {
+      if (old[i].value == kEmpty)
+        continue;
+      size_t pos = hash(old[i].key) & mask;
+      while (entries_[pos].value != kEmpty)
+        pos = (pos + 1) & mask;
+      entries_[pos] = old[i];
+    }
+  }
+
+  std::vector<entry> entries_;
+  size_t size_;
+};
 
 struct obj_shape {
   std::vector<float> v;
@@ -267,6 +414,18 @@ struct obj_shape {
   std::vector<float> vt;
 };
 
+// Faces stored back to back, to avoid an allocation per face.
+struct face_group {
+  std::vector<vertex_index> corners;
+  std::vector<unsigned int> num_corners; // per face
+
+  bool empty() const { return num_corners.empty(); }
+  void clear() {
+    corners.clear();
+    num_corners.clear();
+  }
+};
+
 //See http://stackoverflow.com/questions/6089231/getting-std-ifstream-to-handle-lf-cr-and-crlf
 std::istream& safeGetline(std::istream& is, std::string& t)
 {
@@ -301,10 +460,113 @@ std::istream& safeGetline(std::istream& is, std::string& t)
     }
 }
 
+// Read-only memory mapping of a whole file.
+class mapped_file {
+public:
+  mapped_file() : data_(NULL), size_(0) {}
+  ~mapped_file() { close(); }
+
+  // Returns false when the file cannot be opened or mapped.
+  bool open(const char *filename) {
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+      return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+      CloseHandle(file);
+      return false;
+    }
+    if (size.QuadPart == 0) {
+      CloseHandle(file);
+      return true;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping) {
+      return false;
+    }
+    // The view keeps the mapping alive after its handle is closed.
+    void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!view) {
+      return false;
+    }
+    data_ = static_cast<const char *>(view);
+    size_ = static_cast<size_t>(size.QuadPart);
+#else
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+      ::close(fd);
+      return false;
+    }
+    if (st.st_size == 0) {
+      ::close(fd);
+      return true;
+    }
+    void *addr = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ,
+                      MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+      return false;
+    }
+    madvise(addr, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+    data_ = static_cast<const char *>(addr);
+    size_ = static_cast<size_t>(st.st_size);
+#endif
+    return true;
+  }
+
+  void close() {
+    if (data_) {
+#ifdef _WIN32
+      UnmapViewOfFile(data_);
+#else
+      munmap(const_cast<char *>(data_), size_);
+#endif
+    }
+    data_ = NULL;
+    size_ = 0;
+  }
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  mapped_file(const mapped_file &);
+  mapped_file &operator=(const mapped_file &);
+
+  const char *data_;
+  size_t size_;
+};
+
 #define IS_SPACE( x ) ( ( (x) == ' ') || ( (x) == '\t') )
 #define IS_DIGIT( x ) ( (unsigned int)( (x) - '0' ) < (unsigned int)10 )
 #define IS_NEW_LINE( x ) ( ( (x) == '\r') || ( (x) == '\n') || ( (x) == '\0') )
 
+// Returns the end of the line beginning at `p`(excluding the line ending).
+static inline const char *findLineEnd(const char *p, const char *end) {
+  while (p != end && *p != '\n' && *p != '\r')
+    p++;
+  return p;
+}
+
+// Returns the beginning of the line next to the one ending at `p`.
+static inline const char *skipLineEnd(const char *p, const char *end) {
+  if (p != end && *p == '\r')
+    p++;
+  if (p != end && *p == '\n')
+    p++;
+  return p;
+}
+
 // Make index zero-base, and also support relative index.
 static inline int fixIndex(int idx, int n) {
   if (idx > 0)
@@ -330,6 +592,64 @@ static inline int parseInt(const char *&token) {
   return i;
 }
 
+// Fast path of tryParseDouble for fixed-format numbers, which is what .obj
+// exporters write. The digits are accumulated into an integer which is then
+// divided by an exact power of ten. As long as the integer fits in the 53-bit
+// mantissa and the power is at most 1e22, both operands are exact and the
+// result is correctly rounded.
+//
+// Returns false without touching `result` when the number has an exponent
+// or too many digits, so the caller can fall back to the general parser.
+static inline bool tryParseFixedDouble(const char *s, const char *s_end,
+                                       double *result) {
+  static const double kPow10[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  const unsigned long long kMaxExact = 1ull << 53;
+  const int kMaxDigits = 19; // never overflows 64 bits
+
+  const char *curr = s;
+  bool negative = false;
+  if (*curr == '+' || *curr == '-') {
+    negative = (*curr == '-');
+    curr++;
+  }
+
+  unsigned long long mantissa = 0;
+  const char *begin = curr;
+  while (curr != s_end && IS_DIGIT(*curr)) {
+    mantissa = mantissa * 10 + static_cast<unsigned int>(*curr - '0');
+    curr++;
+  }
+  int digits = static_cast<int>(curr - begin);
+  if (digits == 0) {
+    return false;
+  }
+
+  int fraction = 0;
+  if (curr != s_end && *curr == '.') {
+    curr++;
+    begin = curr;
+    while (curr != s_end && IS_DIGIT(*curr)) {
+      mantissa = mantissa * 10 + static_cast<unsigned int>(*curr - '0');
+      curr++;
+    }
+    fraction = static_cast<int>(curr - begin);
+    digits += fraction;
+  }
+
+  if (curr != s_end && (*curr == 'e' || *curr == 'E')) {
+    return false;
+  }
+  if (digits > kMaxDigits || mantissa > kMaxExact || fraction > 22) {
+    return false;
+  }
+
+  double value = static_cast<double>(mantissa) / kPow10[fraction];
+  *result = negative ? -value : value;
+  return true;
+}
+
 // Tries to parse a floating point number located at s.
 //
 // s_end should be a location in the string where reading should absolutely
@@ -362,6 +682,10 @@ static bool tryParseDouble(const char *s, const char *s_end, double *result) {
     return false;
   }
 
+  if (tryParseFixedDouble(s, s_end, result)) {
+    return true;
+  }
+
   double mantissa = 0.0;
   // This exponent is base 2 rather than 10.
   // However the exponent we parse is supposed to be one of ten,
@@ -465,9 +789,9 @@ static inline float parseFloat(const char *&token) {
   token += strspn(token, " \t");
 #ifdef TINY_OBJ_LOADER_OLD_FLOAT_PARSER
   float f = (float)atof(token);
-  token += strcspn(token, " \t\r");
+  token += strcspn(token, " \t\r\n");
 #else
-  const char *end = token + strcspn(token, " \t\r");
+  const char *end = token + strcspn(token, " \t\r\n");
   double val = 0.0;
   tryParseDouble(token, end, &val);
   float f = static_cast<float>(val);
@@ -512,12 +836,18 @@ static tag_sizes parseTagTriple(const char *&token) {
 }
 
 // Parse triples: i, i/j/k, i//k, i/j
+// When `relative` is given, bit 0, 1 and 2 of it are set when the position,
+// texcoord and normal index are relative(negative) respectively.
 static vertex_index parseTriple(const char *&token, int vsize, int vnsize,
-                                int vtsize) {
+                                int vtsize, unsigned char *relative = NULL) {
   vertex_index vi(-1);
+  int idx;
 
-  vi.v_idx = fixIndex(atoi(token), vsize);
-  token += strcspn(token, "/ \t\r");
+  idx = atoi(token);
+  if (relative && idx < 0)
+    *relative |= 1;
+  vi.v_idx = fixIndex(idx, vsize);
+  token += strcspn(token, "/ \t\r\n");
   if (token[0] != '/') {
     return vi;
   }
@@ -526,37 +856,47 @@ static vertex_index parseTriple(const char *&token, int vsize, int vnsize,
   // i//k
   if (token[0] == '/') {
     token++;
-    vi.vn_idx = fixIndex(atoi(token), vnsize);
-    token += strcspn(token, "/ \t\r");
+    idx = atoi(token);
+    if (relative && idx < 0)
+      *relative |= 4;
+    vi.vn_idx = fixIndex(idx, vnsize);
+    token += strcspn(token, "/ \t\r\n");
     return vi;
   }
 
   // i/j/k or i/j
-  vi.vt_idx = fixIndex(atoi(token), vtsize);
-  token += strcspn(token, "/ \t\r");
+  idx = atoi(token);
+  if (relative && idx < 0)
+    *relative |= 2;
+  vi.vt_idx = fixIndex(idx, vtsize);
+  token += strcspn(token, "/ \t\r\n");
   if (token[0] != '/') {
     return vi;
   }
 
   // i/j/k
   token++; // skip '/'
-  vi.vn_idx = fixIndex(atoi(token), vnsize);
-  token += strcspn(token, "/ \t\r");
+  idx = atoi(token);
+  if (relative && idx < 0)
+    *relative |= 4;
+  vi.vn_idx = fixIndex(idx, vnsize);
+  token += strcspn(token, "/ \t\r\n");
   return vi;
 }
 
 static unsigned int
-updateVertex(std::map<vertex_index, unsigned int> &vertexCache,
+updateVertex(vertex_cache &vertexCache,
              std::vector<float> &positions, std::vector<float> &normals,
              std::vector<float> &texcoords,
              const std::vector<float> &in_positions,
              const std::vector<float> &in_normals,
              const std::vector<float> &in_texcoords, const vertex_index &i) {
-  const std::map<vertex_index, unsigned int>::iterator it = vertexCache.find(i);
+  const unsigned int newIdx = static_cast<unsigned int>(positions.size() / 3);
+  const unsigned int idx = vertexCache.insert(i, newIdx);
 
-  if (it != vertexCache.end()) {
+  if (idx != newIdx) {
     // found cache
-    return it->second;
+    return idx;
   }
 
   assert(in_positions.size() > static_cast<unsigned int>(3 * i.v_idx + 2));
@@ -578,9 +918,6 @@ updateVertex(std::map<vertex_index, unsigned int> &vertexCache,
     texcoords.push_back(in_texcoords[2 * static_cast<size_t>(i.vt_idx) + 1]);
   }
 
-  unsigned int idx = static_cast<unsigned int>(positions.size() / 3 - 1);
-  vertexCache[i] = idx;
-
   return idx;
 }
 
@@ -608,11 +945,11 @@ static void InitMaterial(material_t &material) {
 }
 
 static bool exportFaceGroupToShape(
-    shape_t &shape, std::map<vertex_index, unsigned int> vertexCache,
+    shape_t &shape, vertex_cache &vertexCache,
     const std::vector<float> &in_positions,
     const std::vector<float> &in_normals,
     const std::vector<float> &in_texcoords,
-    const std::vector<std::vector<vertex_index> > &faceGroup,
+    const face_group &faceGroup,
     std::vector<tag_t> &tags, const int material_id, const std::string &name,
     bool clearCache, unsigned int flags, std::string& err ) {
   if (faceGroup.empty()) {
@@ -622,15 +959,20 @@ static bool exportFaceGroupToShape(
   bool triangulate( ( flags & triangulation ) == triangulation );
   bool normals_calculation( ( flags & calculate_normals ) == calculate_normals );
 
+  // A shape has at most as many vertices as corners. Reserve for the number
+  // of faces, which is close to the number of unique vertices of a mesh.
+  vertexCache.reserve(faceGroup.num_corners.size());
+
   // Flatten vertices and indices
-  for (size_t i = 0; i < faceGroup.size(); i++) {
-    const std::vector<vertex_index> &face = faceGroup[i];
+  size_t offset = 0;
+  for (size_t i = 0; i < faceGroup.num_corners.size(); i++) {
+    const vertex_index *face = faceGroup.corners.data() + offset;
+    size_t npolys = faceGroup.num_corners[i];
+    offset += npolys;
 
-    vertex_index i0 = face[0];
+    vertex_index i0 = npolys > 0 ? face[0] : vertex_index(-1);
     vertex_index i1(-1);
-    vertex_index i2 = face[1];
-
-    size_t npolys = face.size();
+    vertex_index i2 = npolys > 1 ? face[1] : vertex_index(-1);
 
     if (triangulate) {
 
@@ -709,224 +1051,258 @@ static bool exportFaceGroupToShape(
   return true;
 }
 
-void LoadMtl(std::map<std::string, int> &material_map,
-             std::vector<material_t> &materials, std::istream &inStream) {
+// Parses one line of .mtl into `material`. `token` must be NUL-terminated
+// and must not contain the line ending.
+static void parseMtlLine(std::map<std::string, int> &material_map,
+                         std::vector<material_t> &materials,
+                         material_t &material, const char *token) {
+  // Skip leading space.
+  token += strspn(token, " \t");
 
-  // Create a default material anyway.
-  material_t material;
-  InitMaterial(material);
+  assert(token);
+  if (token[0] == '\0')
+    return; // empty line
 
-  while (inStream.peek() != -1) {
-    std::string linebuf;
-    safeGetline(inStream, linebuf);
+  if (token[0] == '#')
+    return; // comment line
 
-    // Trim newline '\r\n' or '\n'
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\n')
-        linebuf.erase(linebuf.size() - 1);
-    }
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\r')
-        linebuf.erase(linebuf.size() - 1);
+  // new mtl
+  if ((0 == strncmp(token, "newmtl", 6)) && IS_SPACE((token[6]))) {
+    // flush previous material.
+    if (!material.name.empty()) {
+      material_map.insert(std::pair<std::string, int>(
+          material.name, static_cast<int>(materials.size())));
+      materials.push_back(material);
     }
 
-    // Skip if empty line.
-    if (linebuf.empty()) {
-      continue;
-    }
+    // initial temporary material
+    InitMaterial(material);
 
-    // Skip leading space.
-    const char *token = linebuf.c_str();
-    token += strspn(token, " \t");
+    // set new mtl name
+    char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+    token += 7;
+#ifdef _MSC_VER
+    sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+    sscanf(token, "%s", namebuf);
+#endif
+    material.name = namebuf;
+    return;
+  }
 
-    assert(token);
-    if (token[0] == '\0')
-      continue; // empty line
+  // ambient
+  if (token[0] == 'K' && token[1] == 'a' && IS_SPACE((token[2]))) {
+    token += 2;
+    float r, g, b;
+    parseFloat3(r, g, b, token);
+    material.ambient[0] = r;
+    material.ambient[1] = g;
+    material.ambient[2] = b;
+    return;
+  }
 
-    if (token[0] == '#')
-      continue; // comment line
+  // diffuse
+  if (token[0] == 'K' && token[1] == 'd' && IS_SPACE((token[2]))) {
+    token += 2;
+    float r, g, b;
+    parseFloat3(r, g, b, token);
+    material.diffuse[0] = r;
+    material.diffuse[1] = g;
+    material.diffuse[2] = b;
+    return;
+  }
 
-    // new mtl
-    if ((0 == strncmp(token, "newmtl", 6)) && IS_SPACE((token[6]))) {
-      // flush previous material.
-      if (!material.name.empty()) {
-        material_map.insert(std::pair<std::string, int>(
-            material.name, static_cast<int>(materials.size())));
-        materials.push_back(material);
-      }
+  // specular
+  if (token[0] == 'K' && token[1] == 's' && IS_SPACE((token[2]))) {
+    token += 2;
+    float r, g, b;
+    parseFloat3(r, g, b, token);
+    material.specular[0] = r;
+    material.specular[1] = g;
+    material.specular[2] = b;
+    return;
+  }
 
-      // initial temporary material
-      InitMaterial(material);
+  // transmittance
+  if (token[0] == 'K' && token[1] == 't' && IS_SPACE((token[2]))) {
+    token += 2;
+    float r, g, b;
+    parseFloat3(r, g, b, token);
+    material.transmittance[0] = r;
+    material.transmittance[1] = g;
+    material.transmittance[2] = b;
+    return;
+  }
 
-      // set new mtl name
-      char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
-      token += 7;
-#ifdef _MSC_VER
-      sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
-#else
-      sscanf(token, "%s", namebuf);
-#endif
-      material.name = namebuf;
-      continue;
-    }
+  // ior(index of refraction)
+  if (token[0] == 'N' && token[1] == 'i' && IS_SPACE((token[2]))) {
+    token += 2;
+    material.ior = parseFloat(token);
+    return;
+  }
 
-    // ambient
-    if (token[0] == 'K' && token[1] == 'a' && IS_SPACE((token[2]))) {
-      token += 2;
-      float r, g, b;
-      parseFloat3(r, g, b, token);
-      material.ambient[0] = r;
-      material.ambient[1] = g;
-      material.ambient[2] = b;
-      continue;
-    }
+  // emission
+  if (token[0] == 'K' && token[1] == 'e' && IS_SPACE(token[2])) {
+    token += 2;
+    float r, g, b;
+    parseFloat3(r, g, b, token);
+    material.emission[0] = r;
+    material.emission[1] = g;
+    material.emission[2] = b;
+    return;
+  }
 
-    // diffuse
-    if (token[0] == 'K' && token[1] == 'd' && IS_SPACE((token[2]))) {
-      token += 2;
-      float r, g, b;
-      parseFloat3(r, g, b, token);
-      material.diffuse[0] = r;
-      material.diffuse[1] = g;
-      material.diffuse[2] = b;
-      continue;
-    }
+  // shininess
+  if (token[0] == 'N' && token[1] == 's' && IS_SPACE(token[2])) {
+    token += 2;
+    material.shininess = parseFloat(token);
+    return;
+  }
 
-    // specular
-    if (token[0] == 'K' && token[1] == 's' && IS_SPACE((token[2]))) {
-      token += 2;
-      float r, g, b;
-      parseFloat3(r, g, b, token);
-      material.specular[0] = r;
-      material.specular[1] = g;
-      material.specular[2] = b;
-      continue;
-    }
+  // illum model
+  if (0 == strncmp(token, "illum", 5) && IS_SPACE(token[5])) {
+    token += 6;
+    material.illum = parseInt(token);
+    return;
+  }
 
-    // transmittance
-    if (token[0] == 'K' && token[1] == 't' && IS_SPACE((token[2]))) {
-      token += 2;
-      float r, g, b;
-      parseFloat3(r, g, b, token);
-      material.transmittance[0] = r;
-      material.transmittance[1] = g;
-      material.transmittance[2] = b;
-      continue;
-    }
+  // dissolve
+  if ((token[0] == 'd' && IS_SPACE(token[1]))) {
+    token += 1;
+    material.dissolve = parseFloat(token);
+    return;
+  }
+  if (token[0] == 'T' && token[1] == 'r' && IS_SPACE(token[2])) {
+    token += 2;
+    // Invert value of Tr(assume Tr is in range [0, 1])
+    material.dissolve = 1.0f - parseFloat(token);
+    return;
+  }
 
-    // ior(index of refraction)
-    if (token[0] == 'N' && token[1] == 'i' && IS_SPACE((token[2]))) {
-      token += 2;
-      material.ior = parseFloat(token);
-      continue;
-    }
+  // ambient texture
+  if ((0 == strncmp(token, "map_Ka", 6)) && IS_SPACE(token[6])) {
+    token += 7;
+    material.ambient_texname = token;
+    return;
+  }
 
-    // emission
-    if (token[0] == 'K' && token[1] == 'e' && IS_SPACE(token[2])) {
-      token += 2;
-      float r, g, b;
-      parseFloat3(r, g, b, token);
-      material.emission[0] = r;
-      material.emission[1] = g;
-      material.emission[2] = b;
-      continue;
-    }
+  // diffuse texture
+  if ((0 == strncmp(token, "map_Kd", 6)) && IS_SPACE(token[6])) {
+    token += 7;
+    material.diffuse_texname = token;
+    return;
+  }
 
-    // shininess
-    if (token[0] == 'N' && token[1] == 's' && IS_SPACE(token[2])) {
-      token += 2;
-      material.shininess = parseFloat(token);
-      continue;
-    }
+  // specular texture
+  if ((0 == strncmp(token, "map_Ks", 6)) && IS_SPACE(token[6])) {
+    token += 7;
+    material.specular_texname = token;
+    return;
+  }
 
-    // illum model
-    if (0 == strncmp(token, "illum", 5) && IS_SPACE(token[5])) {
-      token += 6;
-      material.illum = parseInt(token);
-      continue;
-    }
+  // specular highlight texture
+  if ((0 == strncmp(token, "map_Ns", 6)) && IS_SPACE(token[6])) {
+    token += 7;
+    material.specular_highlight_texname = token;
+    return;
+  }
 
-    // dissolve
-    if ((token[0] == 'd' && IS_SPACE(token[1]))) {
-      token += 1;
-      material.dissolve = parseFloat(token);
-      continue;
-    }
-    if (token[0] == 'T' && token[1] == 'r' && IS_SPACE(token[2])) {
-      token += 2;
-      // Invert value of Tr(assume Tr is in range [0, 1])
-      material.dissolve = 1.0f - parseFloat(token);
-      continue;
-    }
+  // bump texture
+  if ((0 == strncmp(token, "map_bump", 8)) && IS_SPACE(token[8])) {
+    token += 9;
+    material.bump_texname = token;
+    return;
+  }
 
-    // ambient texture
-    if ((0 == strncmp(token, "map_Ka", 6)) && IS_SPACE(token[6])) {
-      token += 7;
-      material.ambient_texname = token;
-      continue;
-    }
+  // alpha texture
+  if ((0 == strncmp(token, "map_d", 5)) && IS_SPACE(token[5])) {
+    token += 6;
+    material.alpha_texname = token;
+    return;
+  }
 
-    // diffuse texture
-    if ((0 == strncmp(token, "map_Kd", 6)) && IS_SPACE(token[6])) {
-      token += 7;
-      material.diffuse_texname = token;
-      continue;
-    }
+  // bump texture
+  if ((0 == strncmp(token, "bump", 4)) && IS_SPACE(token[4])) {
+    token += 5;
+    material.bump_texname = token;
+    return;
+  }
 
-    // specular texture
-    if ((0 == strncmp(token, "map_Ks", 6)) && IS_SPACE(token[6])) {
-      token += 7;
-      material.specular_texname = token;
-      continue;
-    }
+  // displacement texture
+  if ((0 == strncmp(token, "disp", 4)) && IS_SPACE(token[4])) {
+    token += 5;
+    material.displacement_texname = token;
+    return;
+  }
 
-    // specular highlight texture
-    if ((0 == strncmp(token, "map_Ns", 6)) && IS_SPACE(token[6])) {
-      token += 7;
-      material.specular_highlight_texname = token;
-      continue;
-    }
+  // unknown parameter
+  const char *_space = strchr(token, ' ');
+  if (!_space) {
+    _space = strchr(token, '\t');
+  }
+  if (_space) {
+    std::ptrdiff_t len = _space - token;
+    std::string key(token, static_cast<size_t>(len));
+    std::string value = _space + 1;
+    material.unknown_parameter.insert(
+        std::pair<std::string, std::string>(key, value));
+  }
+}
 
-    // bump texture
-    if ((0 == strncmp(token, "map_bump", 8)) && IS_SPACE(token[8])) {
-      token += 9;
-      material.bump_texname = token;
-      continue;
-    }
+void LoadMtl(std::map<std::string, int> &material_map,
+             std::vector<material_t> &materials, std::istream &inStream) {
 
-    // alpha texture
-    if ((0 == strncmp(token, "map_d", 5)) && IS_SPACE(token[5])) {
-      token += 6;
-      material.alpha_texname = token;
-      continue;
-    }
+  // Create a default material anyway.
+  material_t material;
+  InitMaterial(material);
 
-    // bump texture
-    if ((0 == strncmp(token, "bump", 4)) && IS_SPACE(token[4])) {
-      token += 5;
-      material.bump_texname = token;
-      continue;
+  while (inStream.peek() != -1) {
+    std::string linebuf;
+    safeGetline(inStream, linebuf);
+
+    // Trim newline '\r\n' or '\n'
+    if (linebuf.size() > 0) {
+      if (linebuf[linebuf.size() - 1] == '\n')
+        linebuf.erase(linebuf.size() - 1);
+    }
+    if (linebuf.size() > 0) {
+      if (linebuf[linebuf.size() - 1] == '\r')
+        linebuf.erase(linebuf.size() - 1);
     }
 
-    // displacement texture
-    if ((0 == strncmp(token, "disp", 4)) && IS_SPACE(token[4])) {
-      token += 5;
-      material.displacement_texname = token;
+    // Skip if empty line.
+    if (linebuf.empty()) {
       continue;
     }
 
-    // unknown parameter
-    const char *_space = strchr(token, ' ');
-    if (!_space) {
-      _space = strchr(token, '\t');
-    }
-    if (_space) {
-      std::ptrdiff_t len = _space - token;
-      std::string key(token, static_cast<size_t>(len));
-      std::string value = _space + 1;
-      material.unknown_parameter.insert(
-          std::pair<std::string, std::string>(key, value));
+    parseMtlLine(material_map, materials, material, linebuf.c_str());
+  }
+  // flush last material.
+  material_map.insert(std::pair<std::string, int>(
+      material.name, static_cast<int>(materials.size())));
+  materials.push_back(material);
+}
+
+void LoadMtl(std::map<std::string, int> &material_map,
+             std::vector<material_t> &materials, const char *buffer,
+             size_t length) {
+
+  // Create a default material anyway.
+  material_t material;
+  InitMaterial(material);
+
+  // One line buffer is reused, so parsing does not allocate per line.
+  std::string linebuf;
+
+  const char *bufEnd = buffer + length;
+  const char *p = buffer;
+  while (p != bufEnd) {
+    const char *eol = findLineEnd(p, bufEnd);
+    if (eol != p) {
+      linebuf.assign(p, eol);
+      parseMtlLine(material_map, materials, material, linebuf.c_str());
     }
+    p = skipLineEnd(eol, bufEnd);
   }
   // flush last material.
   material_map.insert(std::pair<std::string, int>(
@@ -946,6 +1322,12 @@ bool MaterialFileReader::operator()(const std::string &matId,
     filepath = matId;
   }
 
+  mapped_file mapped;
+  if (mapped.open(filepath.c_str())) {
+    LoadMtl(matMap, materials, mapped.data(), mapped.size());
+    return true;
+  }
+
   std::ifstream matIStream(filepath.c_str());
   LoadMtl(matMap, materials, matIStream);
   if (!matIStream) {
@@ -962,305 +1344,726 @@ bool LoadObj(std::vector<shape_t> &shapes,       // [output]
              std::string &err, const char *filename, const char *mtl_basepath,
              unsigned int flags) {
 
+  std::string basePath;
+  if (mtl_basepath) {
+    basePath = mtl_basepath;
+  }
+  MaterialFileReader matFileReader(basePath);
+
+  return LoadObj(shapes, materials, err, filename, matFileReader, flags);
+}
+
+bool LoadObj(std::vector<shape_t> &shapes,       // [output]
+             std::vector<material_t> &materials, // [output]
+             std::string &err, const char *filename,
+             MaterialReader &readMatFn, unsigned int flags) {
+
   shapes.clear();
 
   std::stringstream errss;
 
-  std::ifstream ifs(filename);
+  // Parse in place from the page cache when the file can be mapped.
+  mapped_file mapped;
+  if (mapped.open(filename)) {
+    return LoadObj(shapes, materials, err, mapped.data(), mapped.size(),
+                   readMatFn, flags);
+  }
+
+  std::ifstream ifs(filename, std::ios::in | std::ios::binary);
   if (!ifs) {
     errss << "Cannot open file [" << filename << "]" << std::endl;
     err = errss.str();
     return false;
   }
 
-  std::string basePath;
-  if (mtl_basepath) {
-    basePath = mtl_basepath;
+  if (flags & parallel_parsing) {
+    // Chunks are cut from the whole file in memory.
+    std::vector<char> buffer;
+    ifs.seekg(0, std::ios::end);
+    std::streamoff size = ifs.tellg();
+    ifs.seekg(0, std::ios::beg);
+    if (size > 0) {
+      buffer.resize(static_cast<size_t>(size));
+      ifs.read(&buffer[0], size);
+    }
+    return LoadObj(shapes, materials, err, buffer.data(), buffer.size(),
+                   readMatFn, flags);
   }
-  MaterialFileReader matFileReader(basePath);
 
-  return LoadObj(shapes, materials, err, ifs, matFileReader, flags);
+  return LoadObj(shapes, materials, err, ifs, readMatFn, flags);
 }
 
-bool LoadObj(std::vector<shape_t> &shapes,       // [output]
-             std::vector<material_t> &materials, // [output]
-             std::string &err, std::istream &inStream,
-             MaterialReader &readMatFn, unsigned int flags) {
-
-  std::stringstream errss;
+// State of the .obj reader, shared by the stream and the buffer parser.
+struct obj_reader_state {
+  obj_reader_state() : material(-1), shapeFn(NULL), maxFaces(0) {}
 
   std::vector<float> v;
   std::vector<float> vn;
   std::vector<float> vt;
   std::vector<tag_t> tags;
-  std::vector<std::vector<vertex_index> > faceGroup;
+  face_group faceGroup;
   std::string name;
 
   // material
   std::map<std::string, int> material_map;
-  std::map<vertex_index, unsigned int> vertexCache;
-  int material = -1;
+  vertex_cache vertexCache;
+  int material;
 
   shape_t shape;
 
-  while (inStream.peek() != -1) {
-    std::string linebuf;
-    safeGetline(inStream, linebuf);
+  // Receives shapes as soon as they are complete when streaming.
+  ShapeCallback *shapeFn;
+  size_t maxFaces;
+};
 
-    // Trim newline '\r\n' or '\n'
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\n')
-        linebuf.erase(linebuf.size() - 1);
+// Hands the current shape to the callback when streaming, otherwise keeps it.
+// Returns false when the callback aborts loading.
+static bool emitShape(obj_reader_state &st, std::vector<shape_t> &shapes,
+                      const std::vector<material_t> &materials) {
+  if (st.shapeFn) {
+    return (*st.shapeFn)(st.shape, materials);
+  }
+  shapes.push_back(st.shape);
+  return true;
+}
+
+// Exports the current face group and emits it as a shape of its own.
+// Only used when streaming. Returns false when the callback aborts loading.
+static bool flushFaceGroup(obj_reader_state &st,
+                           const std::vector<material_t> &materials,
+                           unsigned int flags, std::string &err) {
+  bool ret = exportFaceGroupToShape(st.shape, st.vertexCache, st.v, st.vn,
+                                    st.vt, st.faceGroup, st.tags, st.material,
+                                    st.name, true, flags, err);
+  bool ok = !ret || (*st.shapeFn)(st.shape, materials);
+  st.shape = shape_t();
+  st.faceGroup.clear();
+  return ok;
+}
+
+// Parses one line of .obj. `token` must be NUL-terminated and must not
+// contain the line ending.
+// Returns false when loading must be aborted.
+static bool parseObjLine(obj_reader_state &st, const char *token,
+                         std::vector<shape_t> &shapes,
+                         std::vector<material_t> &materials,
+                         MaterialReader &readMatFn, unsigned int flags,
+                         std::string &err) {
+  // Skip leading space.
+  token += strspn(token, " \t");
+
+  assert(token);
+  if (token[0] == '\0')
+    return true; // empty line
+
+  if (token[0] == '#')
+    return true; // comment line
+
+  // vertex
+  if (token[0] == 'v' && IS_SPACE((token[1]))) {
+    token += 2;
+    float x, y, z;
+    parseFloat3(x, y, z, token);
+    st.v.push_back(x);
+    st.v.push_back(y);
+    st.v.push_back(z);
+    return true;
+  }
+
+  // normal
+  if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
+    token += 3;
+    float x, y, z;
+    parseFloat3(x, y, z, token);
+    st.vn.push_back(x);
+    st.vn.push_back(y);
+    st.vn.push_back(z);
+    return true;
+  }
+
+  // texcoord
+  if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
+    token += 3;
+    float x, y;
+    parseFloat2(x, y, token);
+    st.vt.push_back(x);
+    st.vt.push_back(y);
+    return true;
+  }
+
+  // face
+  if (token[0] == 'f' && IS_SPACE((token[1]))) {
+    token += 2;
+    token += strspn(token, " \t");
+
+    unsigned int n = 0;
+    while (!IS_NEW_LINE(token[0])) {
+      vertex_index vi = parseTriple(token, static_cast<int>(st.v.size() / 3),
+                                    static_cast<int>(st.vn.size() / 3),
+                                    static_cast<int>(st.vt.size() / 2));
+      st.faceGroup.corners.push_back(vi);
+      n++;
+      size_t len = strspn(token, " \t\r");
+      token += len;
     }
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\r')
-        linebuf.erase(linebuf.size() - 1);
+    st.faceGroup.num_corners.push_back(n);
+
+    if (st.shapeFn && st.faceGroup.num_corners.size() >= st.maxFaces) {
+      return flushFaceGroup(st, materials, flags, err);
     }
 
-    // Skip if empty line.
-    if (linebuf.empty()) {
-      continue;
+    return true;
+  }
+
+  // use mtl
+  if ((0 == strncmp(token, "usemtl", 6)) && IS_SPACE((token[6]))) {
+
+    char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+    token += 7;
+#ifdef _MSC_VER
+    sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+    sscanf(token, "%s", namebuf);
+#endif
+
+    int newMaterialId = -1;
+    if (st.material_map.find(namebuf) != st.material_map.end()) {
+      newMaterialId = st.material_map[namebuf];
+    } else {
+      // { error!! material not found }
     }
 
-    // Skip leading space.
-    const char *token = linebuf.c_str();
-    token += strspn(token, " \t");
+    if (newMaterialId != st.material) {
+      // Create per-face material
+      if (st.shapeFn) {
+        if (!flushFaceGroup(st, materials, flags, err)) {
+          return false;
+        }
+      } else {
+        exportFaceGroupToShape(st.shape, st.vertexCache, st.v, st.vn, st.vt,
+                               st.faceGroup, st.tags, st.material, st.name,
+                               true, flags, err);
+      }
+      st.faceGroup.clear();
+      st.material = newMaterialId;
+    }
+
+    return true;
+  }
 
-    assert(token);
-    if (token[0] == '\0')
-      continue; // empty line
+  // load mtl
+  if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
+    char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+    token += 7;
+#ifdef _MSC_VER
+    sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+    sscanf(token, "%s", namebuf);
+#endif
 
-    if (token[0] == '#')
-      continue; // comment line
+    std::string err_mtl;
+    bool ok = readMatFn(namebuf, materials, st.material_map, err_mtl);
+    err += err_mtl;
 
-    // vertex
-    if (token[0] == 'v' && IS_SPACE((token[1]))) {
-      token += 2;
-      float x, y, z;
-      parseFloat3(x, y, z, token);
-      v.push_back(x);
-      v.push_back(y);
-      v.push_back(z);
-      continue;
+    if (!ok) {
+      st.faceGroup.clear(); // for safety
+      return false;
     }
 
-    // normal
-    if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
-      token += 3;
-      float x, y, z;
-      parseFloat3(x, y, z, token);
-      vn.push_back(x);
-      vn.push_back(y);
-      vn.push_back(z);
-      continue;
+    return true;
+  }
+
+  // group name
+  if (token[0] == 'g' && IS_SPACE((token[1]))) {
+
+    // flush previous face group.
+    bool ret = exportFaceGroupToShape(st.shape, st.vertexCache, st.v, st.vn,
+                                      st.vt, st.faceGroup, st.tags,
+                                      st.material, st.name, true, flags, err);
+    if (ret && !emitShape(st, shapes, materials)) {
+      return false;
     }
 
-    // texcoord
-    if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
-      token += 3;
-      float x, y;
-      parseFloat2(x, y, token);
-      vt.push_back(x);
-      vt.push_back(y);
-      continue;
+    st.shape = shape_t();
+
+    // material = -1;
+    st.faceGroup.clear();
+
+    std::vector<std::string> names;
+    names.reserve(2);
+
+    while (!IS_NEW_LINE(token[0])) {
+      std::string str = parseString(token);
+      names.push_back(str);
+      token += strspn(token, " \t\r"); // skip tag
     }
 
-    // face
-    if (token[0] == 'f' && IS_SPACE((token[1]))) {
-      token += 2;
-      token += strspn(token, " \t");
+    assert(names.size() > 0);
 
-      std::vector<vertex_index> face;
-      face.reserve(3);
+    // names[0] must be 'g', so skip the 0th element.
+    if (names.size() > 1) {
+      st.name = names[1];
+    } else {
+      st.name = "";
+    }
 
-      while (!IS_NEW_LINE(token[0])) {
-        vertex_index vi = parseTriple(token, static_cast<int>(v.size() / 3),
-                                      static_cast<int>(vn.size() / 3),
-                                      static_cast<int>(vt.size() / 2));
-        face.push_back(vi);
-        size_t n = strspn(token, " \t\r");
-        token += n;
-      }
+    return true;
+  }
 
-      // replace with emplace_back + std::move on C++11
-      faceGroup.push_back(std::vector<vertex_index>());
-      faceGroup[faceGroup.size() - 1].swap(face);
+  // object name
+  if (token[0] == 'o' && IS_SPACE((token[1]))) {
 
-      continue;
+    // flush previous face group.
+    bool ret = exportFaceGroupToShape(st.shape, st.vertexCache, st.v, st.vn,
+                                      st.vt, st.faceGroup, st.tags,
+                                      st.material, st.name, true, flags, err);
+    if (ret && !emitShape(st, shapes, materials)) {
+      return false;
     }
 
-    // use mtl
-    if ((0 == strncmp(token, "usemtl", 6)) && IS_SPACE((token[6]))) {
+    // material = -1;
+    st.faceGroup.clear();
+    st.shape = shape_t();
 
-      char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
-      token += 7;
+    // @todo { multiple object name? }
+    char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+    token += 2;
 #ifdef _MSC_VER
-      sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+    sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
 #else
-      sscanf(token, "%s", namebuf);
+    sscanf(token, "%s", namebuf);
 #endif
+    st.name = std::string(namebuf);
 
-      int newMaterialId = -1;
-      if (material_map.find(namebuf) != material_map.end()) {
-        newMaterialId = material_map[namebuf];
-      } else {
-        // { error!! material not found }
-      }
+    return true;
+  }
 
-      if (newMaterialId != material) {
-        // Create per-face material
-        exportFaceGroupToShape(shape, vertexCache, v, vn, vt, faceGroup, tags,
-                               material, name, true, flags, err );
-        faceGroup.clear();
-        material = newMaterialId;
-      }
+  if (token[0] == 't' && IS_SPACE(token[1])) {
+    tag_t tag;
 
-      continue;
+    char namebuf[4096];
+    token += 2;
+#ifdef _MSC_VER
+    sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+    sscanf(token, "%s", namebuf);
+#endif
+    tag.name = std::string(namebuf);
+
+    token += tag.name.size() + 1;
+
+    tag_sizes ts = parseTagTriple(token);
+
+    tag.intValues.resize(static_cast<size_t>(ts.num_ints));
+
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
+      tag.intValues[i] = atoi(token);
+      token += strcspn(token, "/ \t\r") + 1;
     }
 
-    // load mtl
-    if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
-      char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
-      token += 7;
+    tag.floatValues.resize(static_cast<size_t>(ts.num_floats));
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_floats); ++i) {
+      tag.floatValues[i] = parseFloat(token);
+      token += strcspn(token, "/ \t\r") + 1;
+    }
+
+    tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
+      char stringValueBuffer[4096];
+
 #ifdef _MSC_VER
-      sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+      sscanf_s(token, "%s", stringValueBuffer,
+               (unsigned)_countof(stringValueBuffer));
 #else
-      sscanf(token, "%s", namebuf);
+      sscanf(token, "%s", stringValueBuffer);
 #endif
+      tag.stringValues[i] = stringValueBuffer;
+      token += tag.stringValues[i].size() + 1;
+    }
 
-      std::string err_mtl;
-      bool ok = readMatFn(namebuf, materials, material_map, err_mtl);
-      err += err_mtl;
+    st.tags.push_back(tag);
+  }
 
-      if (!ok) {
-        faceGroup.clear(); // for safety
-        return false;
-      }
+  // Ignore unknown command.
+  return true;
+}
+
+// Flushes the last face group after all lines are parsed.
+static void finishObjReader(obj_reader_state &st, std::vector<shape_t> &shapes,
+                            const std::vector<material_t> &materials,
+                            unsigned int flags, std::string &err) {
+  bool ret = exportFaceGroupToShape(st.shape, st.vertexCache, st.v, st.vn,
+                                    st.vt, st.faceGroup, st.tags, st.material,
+                                    st.name, true, flags, err);
+  if (ret) {
+    emitShape(st, shapes, materials);
+  }
+  st.faceGroup.clear(); // for safety
+}
+
+// Parses `inStream` line by line into the reader.
+static bool parseObjStream(obj_reader_state &st, std::istream &inStream,
+                           std::vector<shape_t> &shapes,
+                           std::vector<material_t> &materials,
+                           MaterialReader &readMatFn, unsigned int flags,
+                           std::string &err) {
+  std::string linebuf;
+  while (inStream.peek() != -1) {
+    safeGetline(inStream, linebuf);
+
+    // Trim newline '\r\n' or '\n'
+    if (linebuf.size() > 0) {
+      if (linebuf[linebuf.size() - 1] == '\n')
+        linebuf.erase(linebuf.size() - 1);
+    }
+    if (linebuf.size() > 0) {
+      if (linebuf[linebuf.size() - 1] == '\r')
+        linebuf.erase(linebuf.size() - 1);
+    }
 
+    // Skip if empty line.
+    if (linebuf.empty()) {
       continue;
     }
 
-    // group name
-    if (token[0] == 'g' && IS_SPACE((token[1]))) {
+    if (!parseObjLine(st, linebuf.c_str(), shapes, materials, readMatFn,
+                      flags, err)) {
+      return false;
+    }
+  }
 
-      // flush previous face group.
-      bool ret =
-          exportFaceGroupToShape(shape, vertexCache, v, vn, vt, faceGroup, tags,
-                                 material, name, true, flags, err );
-      if (ret) {
-        shapes.push_back(shape);
-      }
+  return true;
+}
 
-      shape = shape_t();
+bool LoadObj(std::vector<shape_t> &shapes,       // [output]
+             std::vector<material_t> &materials, // [output]
+             std::string &err, std::istream &inStream,
+             MaterialReader &readMatFn, unsigned int flags) {
 
-      // material = -1;
-      faceGroup.clear();
+  std::stringstream errss;
 
-      std::vector<std::string> names;
-      names.reserve(2);
+  obj_reader_state state;
+  if (!parseObjStream(state, inStream, shapes, materials, readMatFn, flags,
+                      err)) {
+    return false;
+  }
 
-      while (!IS_NEW_LINE(token[0])) {
-        std::string str = parseString(token);
-        names.push_back(str);
-        token += strspn(token, " \t\r"); // skip tag
-      }
+  finishObjReader(state, shapes, materials, flags, err);
 
-      assert(names.size() > 0);
+  err += errss.str();
 
-      // names[0] must be 'g', so skip the 0th element.
-      if (names.size() > 1) {
-        name = names[1];
-      } else {
-        name = "";
-      }
+  return true;
+}
 
-      continue;
-    }
+// Line other than v/vn/vt/f found in a chunk. These lines change the reader
+// state(material, group, ...), so they are replayed in order after the
+// chunks are parsed.
+struct obj_directive {
+  size_t face_pos; // number of faces in the chunk preceding this line
+  const char *begin;
+  const char *end;
+};
 
-    // object name
-    if (token[0] == 'o' && IS_SPACE((token[1]))) {
+// Result of parsing one newline-aligned chunk of .obj.
+struct obj_chunk {
+  std::vector<float> v;
+  std::vector<float> vn;
+  std::vector<float> vt;
+  face_group faces;
+  // Corners with relative indices, which are resolved against the vertices
+  // of this chunk only. Second is the bit mask returned by parseTriple.
+  std::vector<std::pair<size_t, unsigned char> > relative;
+  std::vector<obj_directive> directives;
+};
 
-      // flush previous face group.
-      bool ret =
-          exportFaceGroupToShape(shape, vertexCache, v, vn, vt, faceGroup, tags,
-                                 material, name, true, flags, err );
-      if (ret) {
-        shapes.push_back(shape);
-      }
+// Parses vertex attributes and faces in [begin, end). Other lines are
+// recorded as directives. Safe to run concurrently on distinct chunks.
+static void parseObjChunk(obj_chunk &chunk, const char *begin,
+                          const char *end) {
+  std::string tail;
+
+  const char *p = begin;
+  while (p != end) {
+    const char *eol = findLineEnd(p, end);
+    const char *token = p;
+    if (eol == end) {
+      // The last line without line ending. Tokenizers must not run over the
+      // end of the buffer, so make a NUL-terminated copy.
+      tail.assign(p, eol);
+      token = tail.c_str();
+    }
 
-      // material = -1;
-      faceGroup.clear();
-      shape = shape_t();
+    // Skip leading space.
+    token += strspn(token, " \t");
 
-      // @todo { multiple object name? }
-      char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+    if (IS_NEW_LINE(token[0]) || token[0] == '#') {
+      // empty or comment line
+    } else if (token[0] == 'v' && IS_SPACE((token[1]))) {
       token += 2;
-#ifdef _MSC_VER
-      sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
-#else
-      sscanf(token, "%s", namebuf);
-#endif
-      name = std::string(namebuf);
+      float x, y, z;
+      parseFloat3(x, y, z, token);
+      chunk.v.push_back(x);
+      chunk.v.push_back(y);
+      chunk.v.push_back(z);
+    } else if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
+      token += 3;
+      float x, y, z;
+      parseFloat3(x, y, z, token);
+      chunk.vn.push_back(x);
+      chunk.vn.push_back(y);
+      chunk.vn.push_back(z);
+    } else if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
+      token += 3;
+      float x, y;
+      parseFloat2(x, y, token);
+      chunk.vt.push_back(x);
+      chunk.vt.push_back(y);
+    } else if (token[0] == 'f' && IS_SPACE((token[1]))) {
+      token += 2;
+      token += strspn(token, " \t");
 
-      continue;
+      unsigned int n = 0;
+      while (!IS_NEW_LINE(token[0])) {
+        unsigned char relative = 0;
+        vertex_index vi =
+            parseTriple(token, static_cast<int>(chunk.v.size() / 3),
+                        static_cast<int>(chunk.vn.size() / 3),
+                        static_cast<int>(chunk.vt.size() / 2), &relative);
+        if (relative) {
+          chunk.relative.push_back(
+              std::make_pair(chunk.faces.corners.size(), relative));
+        }
+        chunk.faces.corners.push_back(vi);
+        n++;
+        token += strspn(token, " \t\r");
+      }
+      chunk.faces.num_corners.push_back(n);
+    } else {
+      obj_directive d;
+      d.face_pos = chunk.faces.num_corners.size();
+      d.begin = p;
+      d.end = eol;
+      chunk.directives.push_back(d);
     }
 
-    if (token[0] == 't' && IS_SPACE(token[1])) {
-      tag_t tag;
+    p = skipLineEnd(eol, end);
+  }
+}
 
-      char namebuf[4096];
-      token += 2;
-#ifdef _MSC_VER
-      sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
-#else
-      sscanf(token, "%s", namebuf);
-#endif
-      tag.name = std::string(namebuf);
+// Parses [begin, end) line by line into the reader. Vertex attributes and
+// faces are tokenized in place, and only other lines are copied to a
+// NUL-terminated line buffer.
+static bool parseObjBuffer(obj_reader_state &st, const char *begin,
+                           const char *end, std::vector<shape_t> &shapes,
+                           std::vector<material_t> &materials,
+                           MaterialReader &readMatFn, unsigned int flags,
+                           std::string &err) {
+  std::string linebuf;
+
+  const char *p = begin;
+  while (p != end) {
+    const char *eol = findLineEnd(p, end);
+
+    const char *token = p;
+    while (token != eol && IS_SPACE(*token))
+      token++;
+    const bool inPlace =
+        eol != end && ((token[0] == 'v' && IS_SPACE(token[1])) ||
+                       (token[0] == 'v' && token[1] == 'n' && IS_SPACE(token[2])) ||
+                       (token[0] == 'v' && token[1] == 't' && IS_SPACE(token[2])) ||
+                       (token[0] == 'f' && IS_SPACE(token[1])));
+    if (inPlace) {
+      if (!parseObjLine(st, token, shapes, materials, readMatFn, flags, err)) {
+        return false;
+      }
+    } else if (eol != p) {
+      linebuf.assign(p, eol);
+      if (!parseObjLine(st, linebuf.c_str(), shapes, materials, readMatFn,
+                        flags, err)) {
+        return false;
+      }
+    }
 
-      token += tag.name.size() + 1;
+    p = skipLineEnd(eol, end);
+  }
 
-      tag_sizes ts = parseTagTriple(token);
+  return true;
+}
 
-      tag.intValues.resize(static_cast<size_t>(ts.num_ints));
+// Appends faces [first, last) of `chunk` to the face group of the reader.
+static void appendChunkFaces(obj_reader_state &st, const obj_chunk &chunk,
+                             size_t first, size_t last, size_t &corner) {
+  size_t n = 0;
+  for (size_t i = first; i < last; i++) {
+    n += chunk.faces.num_corners[i];
+  }
+  st.faceGroup.num_corners.insert(st.faceGroup.num_corners.end(),
+                                  chunk.faces.num_corners.begin() + first,
+                                  chunk.faces.num_corners.begin() + last);
+  st.faceGroup.corners.insert(st.faceGroup.corners.end(),
+                              chunk.faces.corners.begin() + corner,
+                              chunk.faces.corners.begin() + corner + n);
+  corner += n;
+}
 
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
-        tag.intValues[i] = atoi(token);
-        token += strcspn(token, "/ \t\r") + 1;
-      }
+bool LoadObj(std::vector<shape_t> &shapes,       // [output]
+             std::vector<material_t> &materials, // [output]
+             std::string &err, const char *buffer, size_t length,
+             MaterialReader &readMatFn, unsigned int flags) {
 
-      tag.floatValues.resize(static_cast<size_t>(ts.num_floats));
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_floats); ++i) {
-        tag.floatValues[i] = parseFloat(token);
-        token += strcspn(token, "/ \t\r") + 1;
-      }
+  const char *bufEnd = buffer + length;
 
-      tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
-        char stringValueBuffer[4096];
+  // Split into newline-aligned chunks. Small files are parsed as one chunk.
+  static const size_t kMinChunkSize = 1 << 20;
+  size_t numThreads = 1;
+  size_t numChunks = 1;
+  if (flags & parallel_parsing) {
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+    numChunks = std::min(numThreads * 4, length / kMinChunkSize + 1);
+    numThreads = std::min(numThreads, numChunks);
+  }
 
-#ifdef _MSC_VER
-        sscanf_s(token, "%s", stringValueBuffer, (unsigned)_countof(stringValueBuffer));
-#else
-        sscanf(token, "%s", stringValueBuffer);
-#endif
-        tag.stringValues[i] = stringValueBuffer;
-        token += tag.stringValues[i].size() + 1;
+  std::vector<const char *> bounds(1, buffer);
+  for (size_t i = 1; i < numChunks; i++) {
+    const char *p = std::max(bounds.back(), buffer + length / numChunks * i);
+    p = static_cast<const char *>(
+        memchr(p, '\n', static_cast<size_t>(bufEnd - p)));
+    if (!p) {
+      break;
+    }
+    bounds.push_back(p + 1);
+  }
+  bounds.push_back(bufEnd);
+  numChunks = bounds.size() - 1;
+
+  if (numChunks == 1) {
+    obj_reader_state state;
+    if (!parseObjBuffer(state, buffer, bufEnd, shapes, materials, readMatFn,
+                        flags, err)) {
+      return false;
+    }
+    finishObjReader(state, shapes, materials, flags, err);
+    return true;
+  }
+
+  // Parse chunks. Workers pick the next unparsed chunk until none is left.
+  std::vector<obj_chunk> chunks(numChunks);
+  std::atomic<size_t> nextChunk(0);
+  auto worker = [&]() {
+    for (;;) {
+      size_t c = nextChunk++;
+      if (c >= numChunks) {
+        break;
       }
+      parseObjChunk(chunks[c], bounds[c], bounds[c + 1]);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < numThreads; i++) {
+    threads.push_back(std::thread(worker));
+  }
+  worker();
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
 
-      tags.push_back(tag);
+  // Merge vertex attributes.
+  obj_reader_state state;
+  std::vector<size_t> vOffset(numChunks + 1, 0);
+  std::vector<size_t> vnOffset(numChunks + 1, 0);
+  std::vector<size_t> vtOffset(numChunks + 1, 0);
+  for (size_t c = 0; c < numChunks; c++) {
+    vOffset[c + 1] = vOffset[c] + chunks[c].v.size();
+    vnOffset[c + 1] = vnOffset[c] + chunks[c].vn.size();
+    vtOffset[c + 1] = vtOffset[c] + chunks[c].vt.size();
+  }
+  state.v.reserve(vOffset[numChunks]);
+  state.vn.reserve(vnOffset[numChunks]);
+  state.vt.reserve(vtOffset[numChunks]);
+  for (size_t c = 0; c < numChunks; c++) {
+    state.v.insert(state.v.end(), chunks[c].v.begin(), chunks[c].v.end());
+    state.vn.insert(state.vn.end(), chunks[c].vn.begin(), chunks[c].vn.end());
+    state.vt.insert(state.vt.end(), chunks[c].vt.begin(), chunks[c].vt.end());
+    std::vector<float>().swap(chunks[c].v);
+    std::vector<float>().swap(chunks[c].vn);
+    std::vector<float>().swap(chunks[c].vt);
+  }
+
+  // Replay faces and directives in the order of the file.
+  std::string linebuf;
+  for (size_t c = 0; c < numChunks; c++) {
+    obj_chunk &chunk = chunks[c];
+
+    // Resolve relative indices against the vertices of preceding chunks.
+    for (size_t i = 0; i < chunk.relative.size(); i++) {
+      vertex_index &vi = chunk.faces.corners[chunk.relative[i].first];
+      const unsigned char mask = chunk.relative[i].second;
+      if (mask & 1)
+        vi.v_idx += static_cast<int>(vOffset[c] / 3);
+      if (mask & 2)
+        vi.vt_idx += static_cast<int>(vtOffset[c] / 2);
+      if (mask & 4)
+        vi.vn_idx += static_cast<int>(vnOffset[c] / 3);
+    }
+
+    size_t face = 0;
+    size_t corner = 0;
+    for (size_t i = 0; i < chunk.directives.size(); i++) {
+      const obj_directive &d = chunk.directives[i];
+      appendChunkFaces(state, chunk, face, d.face_pos, corner);
+      face = d.face_pos;
+
+      linebuf.assign(d.begin, d.end);
+      if (!parseObjLine(state, linebuf.c_str(), shapes, materials, readMatFn,
+                        flags, err)) {
+        return false;
+      }
     }
+    appendChunkFaces(state, chunk, face, chunk.faces.num_corners.size(),
+                     corner);
 
-    // Ignore unknown command.
+    chunk.faces.clear();
   }
 
-  bool ret = exportFaceGroupToShape(shape, vertexCache, v, vn, vt, faceGroup,
-                                    tags, material, name, true, flags, err );
-  if (ret) {
-    shapes.push_back(shape);
+  finishObjReader(state, shapes, materials, flags, err);
+
+  return true;
+}
+
+bool LoadObj(std::vector<material_t> &materials, // [output]
+             std::string &err, const char *filename,
+             MaterialReader &readMatFn, ShapeCallback &shapeFn,
+             size_t max_faces, unsigned int flags) {
+
+  std::vector<shape_t> shapes; // stays empty
+
+  obj_reader_state state;
+  state.shapeFn = &shapeFn;
+  state.maxFaces = std::max(max_faces, static_cast<size_t>(1));
+
+  mapped_file mapped;
+  if (mapped.open(filename)) {
+    if (!parseObjBuffer(state, mapped.data(), mapped.data() + mapped.size(),
+                        shapes, materials, readMatFn, flags, err)) {
+      return false;
+    }
+  } else {
+    std::ifstream ifs(filename, std::ios::in | std::ios::binary);
+    if (!ifs) {
+      std::stringstream errss;
+      errss << "Cannot open file [" << filename << "]" << std::endl;
+      err = errss.str();
+      return false;
+    }
+
+    if (!parseObjStream(state, ifs, shapes, materials, readMatFn, flags,
+                        err)) {
+      return false;
+    }
   }
-  faceGroup.clear(); // for safety
 
-  err += errss.str();
+  finishObjReader(state, shapes, materials, flags, err);
 
   return true;
 }
@@ -5,15 +5,24 @@
 #ifndef _VERTEXARRAYOBJECT_H_
 #define _VERTEXARRAYOBJECT_H_
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
 #include <map>
+#include <memory>
 #include <vector>
 
 #include <QtGui/qopenglshaderprogram.h>
 #include <QtGui/qopenglvertexarrayobject.h>
 #include <QtGui/qopenglbuffer.h>
 #include <QtGui/qopenglfunctions.h>
+#include <QtGui/qopenglextrafunctions.h>
 
+#include "glutils.h"
 #include "imagetexture.h"
+#include "materialtable.h"
+#include "ringbuffer.h"
 
 namespace {
 
@@ -29,20 +38,100 @@ struct AttribInfo {
 
 }  // anonymouse namespace
 
-struct MaterialInfo {
-    QVector3D diffuse = { 1.0f, 1.0f, 1.0f };
-    QVector3D specular = { 0.0f, 0.0f, 0.0f };
-    QVector3D ambient = { 0.0f, 0.0f, 0.0f };
-    float shininess = 1.0f;
-    std::shared_ptr<ImageTexture> diffuse_texture = nullptr;
-    std::shared_ptr<ImageTexture> specular_texture = nullptr;
-    std::shared_ptr<ImageTexture> bump_texture = nullptr;
+//! Formats of vertex attributes in the interleaved buffer.
+enum class VertexFormat {
+    Float,              //! 32-bit float per component.
+    Half,               //! 16-bit float per component.
+    UNorm16,            //! 16-bit unsigned normalized, dequantized in the shader.
+    SNorm10_10_10_2,    //! Signed normalized xyz in 32 bits, e.g., for unit normals.
 };
 
-struct SegmentInfo {
-    int start;
-    int count;
-    MaterialInfo material;
+/**
+ * Layout of an interleaved vertex buffer.
+ * @details
+ * Attributes are packed in the order they are added, each aligned to 4 bytes.
+ * UNorm16 attributes are quantized to the bounds of the data, which the
+ * shader maps back with dequantScale() and dequantOffset() of the
+ * VertexArrayObject.
+ **/
+class VertexLayout {
+public:
+    struct Attrib {
+        uint32_t location;
+        uint8_t tupleSize;
+        VertexFormat format;
+        uint32_t offset;
+    };
+
+    VertexLayout & add(uint32_t location, uint8_t tupleSize, VertexFormat format) {
+        Attrib attrib = { location, tupleSize, format, (uint32_t)stride_ };
+        attribs_.push_back(attrib);
+        stride_ += (byteSize(tupleSize, format) + 3) & ~3;
+        return *this;
+    }
+
+    bool empty() const {
+        return attribs_.empty();
+    }
+
+    int stride() const {
+        return stride_;
+    }
+
+    const std::vector<Attrib> & attribs() const {
+        return attribs_;
+    }
+
+    static int byteSize(uint8_t tupleSize, VertexFormat format) {
+        switch (format) {
+        case VertexFormat::Float:
+            return tupleSize * 4;
+        case VertexFormat::Half:
+        case VertexFormat::UNorm16:
+            return tupleSize * 2;
+        case VertexFormat::SNorm10_10_10_2:
+            return 4;
+        }
+        return 0;
+    }
+
+private:
+    std::vector<Attrib> attribs_;
+    int stride_ = 0;
+};
+
+//! Command of glMultiDrawElementsIndirect.
+struct DrawElementsIndirectCommand {
+    uint32_t count;
+    uint32_t instanceCount;
+    uint32_t firstIndex;
+    int32_t baseVertex;
+    uint32_t baseInstance;
+};
+
+//! Consecutive draw commands drawn with the same shader permutation.
+struct DrawGroup {
+    uint32_t features;
+    GLsizei first;
+    GLsizei count;
+};
+
+//! Splits commands with `features` into runs of the same features.
+inline std::vector<DrawGroup> makeDrawGroups(const std::vector<uint32_t> &features) {
+    std::vector<DrawGroup> groups;
+    for (size_t i = 0; i < features.size(); i++) {
+        if (groups.empty() || groups.back().features != features[i]) {
+            groups.push_back({ features[i], (GLsizei)i, 0 });
+        }
+        groups.back().count++;
+    }
+    return groups;
+}
+
+//! Bytes held by VertexArrayObject on host and on GPU.
+struct VertexMemoryStats {
+    size_t hostBytes = 0;
+    size_t gpuBytes = 0;
 };
 
 /**
@@ -51,10 +140,30 @@ struct SegmentInfo {
  * -- Usage --
  * 1) construct the object.
  * 2) set vertices and indices by addXXX functions.
- * 3) call setReady() to transfer data to GPU.
+ * 3) optionally call setLayout() to pack the attributes into one
+ *    interleaved buffer of compact formats.
+ * 4) call setReady() to transfer data to GPU. The buffers are immutable
+ *    after that, and update() writes new vertices to a ring buffer.
+ *    setReady(true) also releases the host copies of the data.
+ *
+ * Materials of the segments are drawn from a MaterialTable. The index of
+ * the segment is given to the shaders as the integer attribute at
+ * kMaterialLocation, with one instance per segment. The segments are drawn
+ * in groups of the same materialFeatures(), each with its own program of
+ * ShaderPermutations, one by one or by glMultiDrawElementsIndirect per group
+ * when setMultiDrawIndirect() is enabled.
+ * With setDepthStream(), drawDepth() draws from a second VAO which fetches
+ * only the positions, e.g., for a depth pre-pass.
+ *
+ * -- Streaming --
+ * 1) construct the object.
+ * 2) call beginStream() with the tuple sizes of the vertex attributes.
+ * 3) call appendStream() for every batch. Buffers on GPU grow as needed.
  **/
 class VertexArrayObject : protected QOpenGLFunctions {
 public:
+    static constexpr uint32_t kMaterialLocation = 3;
+
     VertexArrayObject() {
         initialize();
     }
@@ -73,6 +182,34 @@ public:
         this->vertexData_ = std::move(vao.vertexData_);
         this->indices_ = std::move(vao.indices_);
         this->attribInfo_ = std::move(vao.attribInfo_);
+        this->layout_ = std::move(vao.layout_);
+        this->dequant_ = std::move(vao.dequant_);
+        this->segmentInfo_ = std::move(vao.segmentInfo_);
+        this->streamTupleSizes_ = std::move(vao.streamTupleSizes_);
+        this->vertexCapacity_ = vao.vertexCapacity_;
+        this->indexCapacity_ = vao.indexCapacity_;
+        this->numStreamVertices_ = vao.numStreamVertices_;
+        this->numStreamIndices_ = vao.numStreamIndices_;
+        this->vertexStride_ = vao.vertexStride_;
+        this->numIndices_ = vao.numIndices_;
+        this->vertexBytes_ = vao.vertexBytes_;
+        this->indexBytes_ = vao.indexBytes_;
+        this->ring_ = std::move(vao.ring_);
+        this->materials_ = std::move(vao.materials_);
+        this->materialsDirty_ = vao.materialsDirty_;
+        this->drawIdBuffer_ = vao.drawIdBuffer_;
+        this->drawIdCapacity_ = vao.drawIdCapacity_;
+        this->indirectBuffer_ = vao.indirectBuffer_;
+        this->drawOrder_ = std::move(vao.drawOrder_);
+        this->drawGroups_ = std::move(vao.drawGroups_);
+        this->depthLocation_ = vao.depthLocation_;
+        this->depthVao_ = vao.depthVao_;
+        this->depthVbo_ = vao.depthVbo_;
+        vao.depthVao_ = nullptr;
+        vao.depthVbo_ = nullptr;
+        this->multiDrawIndirect_ = vao.multiDrawIndirect_;
+        vao.drawIdBuffer_ = 0;
+        vao.indirectBuffer_ = 0;
         vao.vao_ = nullptr;
         vao.vbo_ = nullptr;
         vao.ibo_ = nullptr;
@@ -81,6 +218,28 @@ public:
     }
 
     virtual ~VertexArrayObject() {
+        ring_.reset();
+        materials_.reset();
+        if (drawIdBuffer_) {
+            glDeleteBuffers(1, &drawIdBuffer_);
+            drawIdBuffer_ = 0;
+        }
+
+        if (indirectBuffer_) {
+            glDeleteBuffers(1, &indirectBuffer_);
+            indirectBuffer_ = 0;
+        }
+
+        if (depthVbo_) {
+            delete depthVbo_;
+            depthVbo_ = nullptr;
+        }
+
+        if (depthVao_) {
+            delete depthVao_;
+            depthVao_ = nullptr;
+        }
+
         if (vbo_) {
             delete vbo_;
             vbo_ = nullptr;
@@ -104,29 +263,113 @@ public:
     }
 
     int numIndices() const {
-        return ibo_->size() / sizeof(unsigned int);
+        if (!streamTupleSizes_.empty()) {
+            return (int)numStreamIndices_;
+        }
+        return (int)numIndices_;
+    }
+
+    //! Bytes of vertices and indices kept on host and allocated on GPU.
+    VertexMemoryStats memoryStats() const {
+        VertexMemoryStats stats;
+        stats.hostBytes = vertexData_.capacity() * sizeof(float) + indices_.capacity() * sizeof(uint32_t);
+        stats.gpuBytes = vertexBytes_ + indexBytes_ + (ring_ ? ring_->size() : 0);
+        return stats;
     }
 
     void addVertexAttrib(const std::vector<float> &data, uint32_t location, uint8_t tupleSize) {
-        if (data.empty()) {
+        addVertexAttrib(data.data(), data.size(), location, tupleSize);
+    }
+
+    //! Adds `count` floats from `data`, e.g., a memory-mapped buffer.
+    void addVertexAttrib(const float *data, size_t count, uint32_t location, uint8_t tupleSize) {
+        if (count == 0) {
             printf("[WARNING] size of input data for is empty.");
         }
 
         const uint32_t headPos = vertexData_.size() * sizeof(float);
-        vertexData_.insert(vertexData_.end(), data.begin(), data.end());
+        vertexData_.insert(vertexData_.end(), data, data + count);
         attribInfo_.emplace_back(location, headPos, tupleSize);
     }
 
+    //! Takes `data` holding the values of `attribs` one after another, each
+    //! as {location, tupleSize} for the same number of vertices. `data` is
+    //! moved rather than copied when no vertex attribute has been added.
+    void addVertexAttribs(std::vector<float> &&data, const std::vector<std::pair<uint32_t, uint8_t>> &attribs) {
+        size_t floatsPerVertex = 0;
+        for (const auto &attrib : attribs) {
+            floatsPerVertex += attrib.second;
+        }
+        if (data.empty() || floatsPerVertex == 0) {
+            printf("[WARNING] size of input data is empty.\n");
+            return;
+        }
+
+        const size_t numVertices = data.size() / floatsPerVertex;
+        uint32_t headPos = vertexData_.size() * sizeof(float);
+        if (vertexData_.empty()) {
+            vertexData_ = std::move(data);
+        } else {
+            vertexData_.insert(vertexData_.end(), data.begin(), data.end());
+            std::vector<float>().swap(data);
+        }
+
+        for (const auto &attrib : attribs) {
+            attribInfo_.emplace_back(attrib.first, headPos, attrib.second);
+            headPos += numVertices * attrib.second * sizeof(float);
+        }
+    }
+
     void addIndices(const std::vector<uint32_t> &indices) {
-        indices_.insert(indices_.end(), indices.begin(), indices.end());
+        addIndices(indices.data(), indices.size());
+    }
+
+    void addIndices(const uint32_t *indices, size_t count) {
+        indices_.insert(indices_.end(), indices, indices + count);
+    }
+
+    //! Moves `indices` rather than copying them when none has been added.
+    void addIndices(std::vector<uint32_t> &&indices) {
+        if (indices_.empty()) {
+            indices_ = std::move(indices);
+        } else {
+            addIndices(indices.data(), indices.size());
+            std::vector<uint32_t>().swap(indices);
+        }
     }
 
     void addSegment(const SegmentInfo &segment) {
         segmentInfo_.push_back(segment);
+        materialsDirty_ = true;
+    }
+
+    //! Packs the vertex attributes into an interleaved buffer in setReady().
+    //! Every attribute added by addVertexAttrib() must be in the layout.
+    void setLayout(const VertexLayout &layout) {
+        layout_ = layout;
+    }
+
+    //! Makes setReady() prepare a VAO with only the attribute at `location`
+    //! in a buffer of its own, which drawDepth() draws.
+    void setDepthStream(uint32_t location) {
+        depthLocation_ = (int)location;
+    }
+
+    //! Scale and offset that map a UNorm16 attribute back to its values.
+    //! Identity for other attributes.
+    QVector3D dequantScale(uint32_t location) const {
+        auto it = dequant_.find(location);
+        return it != dequant_.end() ? it->second.first : QVector3D(1.0f, 1.0f, 1.0f);
+    }
+
+    QVector3D dequantOffset(uint32_t location) const {
+        auto it = dequant_.find(location);
+        return it != dequant_.end() ? it->second.second : QVector3D(0.0f, 0.0f, 0.0f);
     }
 
-    //! Allocate memory on GPU and transfer buffers to it.
-    void setReady() {
+    //! Allocate memory on GPU and transfer buffers to it. With
+    //! `releaseHostData`, the vertices and indices kept on host are freed.
+    void setReady(bool releaseHostData = false) {
         vao_->bind();
 
         if (vertexData_.size() == 0) {
@@ -136,10 +379,15 @@ public:
         }
 
         vbo_->bind();
-        vbo_->allocate(&vertexData_[0], vertexData_.size() * sizeof(float));
-        for (const auto &info : attribInfo_) {
-            glEnableVertexAttribArray(info.location);
-            glVertexAttribPointer(info.location, info.size, GL_FLOAT, GL_FALSE, 0, (void*)info.head);
+        if (layout_.empty()) {
+            allocateImmutable(*vbo_, vertexData_.data(), vertexData_.size() * sizeof(float));
+            vertexBytes_ = vertexData_.size() * sizeof(float);
+            for (const auto &info : attribInfo_) {
+                glEnableVertexAttribArray(info.location);
+                glVertexAttribPointer(info.location, info.size, GL_FLOAT, GL_FALSE, 0, (void*)info.head);
+            }
+        } else {
+            allocateInterleaved();
         }
 
         if (indices_.size() == 0) {
@@ -149,57 +397,198 @@ public:
         }
 
         ibo_->bind();
-        ibo_->allocate(&indices_[0], indices_.size() * sizeof(uint32_t));
+        allocateImmutable(*ibo_, indices_.data(), indices_.size() * sizeof(uint32_t));
+        indexBytes_ = indices_.size() * sizeof(uint32_t);
+        numIndices_ = indices_.size();
 
         vao_->release();
+
+        if (depthLocation_ >= 0) {
+            setupDepthVao();
+        }
+
+        if (releaseHostData) {
+            std::vector<float>().swap(vertexData_);
+            std::vector<uint32_t>().swap(indices_);
+        }
+    }
+
+    //! Prepares buffers which grow with appendStream(). Vertex attribute `i`
+    //! has `tupleSizes[i]` floats and is stored in a block of its own.
+    void beginStream(const std::vector<int> &tupleSizes, size_t vertexCapacity, size_t indexCapacity) {
+        streamTupleSizes_ = tupleSizes;
+        vertexCapacity_ = 0;
+        indexCapacity_ = 0;
+        numStreamVertices_ = 0;
+        numStreamIndices_ = 0;
+        reserveStream(vertexCapacity, indexCapacity);
+    }
+
+    //! Appends vertices and indices to the buffers on GPU. `attribs[i]` holds
+    //! the values of attribute `i`, and indices refer to the appended vertices.
+    //! Data are staged in a ring buffer and copied on GPU, so appending does
+    //! not wait for the draws of the vertices appended before.
+    void appendStream(const std::vector<const float*> &attribs, size_t numVertices,
+                      const uint32_t *indices, size_t numIndices) {
+        reserveStream(numStreamVertices_ + numVertices, numStreamIndices_ + numIndices);
+
+        size_t floatsPerVertex = 0;
+        for (int tupleSize : streamTupleSizes_) {
+            floatsPerVertex += tupleSize;
+        }
+        const size_t vertexBytes = numVertices * floatsPerVertex * sizeof(float);
+        const size_t indexBytes = numIndices * sizeof(uint32_t);
+        if (!ring_) {
+            ring_ = std::make_unique<RingBuffer>(vertexBytes + indexBytes);
+        }
+
+        // Attribute blocks followed by the indices shifted to the stream.
+        uint8_t *staging = ring_->map(vertexBytes + indexBytes);
+        size_t pos = 0;
+        for (int i = 0; i < streamTupleSizes_.size(); i++) {
+            const size_t bytes = numVertices * streamTupleSizes_[i] * sizeof(float);
+            memcpy(staging + pos, attribs[i], bytes);
+            pos += bytes;
+        }
+        uint32_t *shifted = (uint32_t*)(staging + pos);
+        for (size_t i = 0; i < numIndices; i++) {
+            shifted[i] = indices[i] + (uint32_t)numStreamVertices_;
+        }
+        const size_t offset = ring_->unmap();
+
+        auto func = QOpenGLContext::currentContext()->extraFunctions();
+        glBindBuffer(GL_COPY_READ_BUFFER, ring_->bufferId());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vbo_->bufferId());
+        size_t head = 0;
+        pos = 0;
+        for (int i = 0; i < streamTupleSizes_.size(); i++) {
+            const size_t tupleSize = streamTupleSizes_[i];
+            const size_t bytes = numVertices * tupleSize * sizeof(float);
+            if (bytes > 0) {
+                func->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset + pos,
+                                          (head * vertexCapacity_ + numStreamVertices_ * tupleSize) * sizeof(float),
+                                          bytes);
+            }
+            head += tupleSize;
+            pos += bytes;
+        }
+        if (indexBytes > 0) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, ibo_->bufferId());
+            func->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset + pos,
+                                      numStreamIndices_ * sizeof(uint32_t), indexBytes);
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        ring_->fence();
+
+        numStreamVertices_ += numVertices;
+        numStreamIndices_ += numIndices;
     }
 
     void drawAs(GLuint drawMode) {
         vao_->bind();
-        glDrawElements(drawMode, indices_.size(), GL_UNSIGNED_INT, 0);
+        glDrawElements(drawMode, (GLsizei)numIndices(), GL_UNSIGNED_INT, 0);
         vao_->release();
     }
 
-    void drawAs(GLuint drawMode, QOpenGLShaderProgram &program) {
+    //! Draws all the segments by one glMultiDrawElementsIndirect when
+    //! `enable` is true and OpenGL 4.3 is available.
+    void setMultiDrawIndirect(bool enable) {
+        multiDrawIndirect_ = enable;
+    }
+
+    bool multiDrawIndirect() const {
+        return multiDrawIndirect_;
+    }
+
+    //! Draws the segments with the programs of `permutations` for their
+    //! materials. `setup` is called with each program after it is bound.
+    void drawAs(GLuint drawMode, ShaderPermutations &permutations,
+                const std::function<void(QOpenGLShaderProgram &)> &setup) {
+        static const auto drawElementsInstancedBaseInstance =
+            glProcAddress<GLDrawElementsInstancedBaseInstanceProc>("glDrawElementsInstancedBaseInstance", 4, 2);
+        static const auto multiDrawElementsIndirect =
+            glProcAddress<GLMultiDrawElementsIndirectProc>("glMultiDrawElementsIndirect", 4, 3);
+        if (!drawElementsInstancedBaseInstance) {
+            printf("[WARNING] glDrawElementsInstancedBaseInstance is not supported.\n");
+            return;
+        }
+
+        updateMaterials();
+        if (multiDrawIndirect_ && multiDrawElementsIndirect) {
+            drawIndirect(drawMode, indirectBuffer_, drawGroups_, permutations, setup);
+            return;
+        }
+
         vao_->bind();
-        for (const auto &seg : segmentInfo_) {
-            program.setUniformValue("u_diffColor", seg.material.diffuse);         
-            program.setUniformValue("u_specColor", seg.material.specular);
-            if (seg.material.diffuse_texture) {
-                glActiveTexture(GL_TEXTURE10);
-                glBindTexture(GL_TEXTURE_2D, seg.material.diffuse_texture->textureId());
-                program.setUniformValue("u_diffuseMap", 10);
-                program.setUniformValue("u_hasDiffuseTex", 1);
-            } else {
-                program.setUniformValue("u_hasDiffuseTex", 0);
-            }
+        materials_->bind();
+        for (const auto &group : drawGroups_) {
+            QOpenGLShaderProgram *program = permutations.program(group.features);
+            if (!program) continue;
 
-            if (seg.material.specular_texture) {
-                glActiveTexture(GL_TEXTURE11);
-                glBindTexture(GL_TEXTURE_2D, seg.material.specular_texture->textureId());
-                program.setUniformValue("u_specularMap", 11);
-                program.setUniformValue("u_hasSpecularTex", 1);
-            } else {
-                program.setUniformValue("u_hasSpecularTex", 0);
-            }
-            program.setUniformValue("u_shininess", seg.material.shininess);
-
-            if (seg.material.bump_texture) {
-                glActiveTexture(GL_TEXTURE12);
-                glBindTexture(GL_TEXTURE_2D, seg.material.diffuse_texture->textureId());
-                program.setUniformValue("u_bumpMap", 12);
-                program.setUniformValue("u_hasBumpTex", 1);
-            } else {
-                program.setUniformValue("u_hasBumpTex", 0);
+            program->bind();
+            setup(*program);
+            for (GLsizei k = group.first; k < group.first + group.count; k++) {
+                const uint32_t i = drawOrder_[k];
+                const auto &seg = segmentInfo_[i];
+                drawElementsInstancedBaseInstance(drawMode, seg.count, GL_UNSIGNED_INT,
+                                                  (void*)(seg.start * sizeof(uint32_t)), 1, (GLuint)i);
             }
+            program->release();
+        }
+        materials_->release();
+        vao_->release();
+    }
 
-            glDrawElements(drawMode, seg.count, GL_UNSIGNED_INT, (void*)(seg.start * sizeof(uint32_t)));
+    //! Draws only the positions given to setDepthStream(), with all the
+    //! segments, or with `drawCount` commands of `commandBuffer` if given.
+    void drawDepth(GLuint drawMode, GLuint commandBuffer = 0, GLsizei drawCount = 0) {
+        static const auto multiDrawElementsIndirect =
+            glProcAddress<GLMultiDrawElementsIndirectProc>("glMultiDrawElementsIndirect", 4, 3);
 
-            for (int i = 0; i < 5; i++) {
-                glActiveTexture(GL_TEXTURE10 + i);
-                glBindTexture(GL_TEXTURE_2D, 0);
-            }
-        }   
+        QOpenGLVertexArrayObject *vao = depthVao_ ? depthVao_ : vao_;
+        vao->bind();
+        if (commandBuffer && multiDrawElementsIndirect) {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+            multiDrawElementsIndirect(drawMode, GL_UNSIGNED_INT, nullptr, drawCount, 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        } else {
+            // Segments cover the index buffer, and no material is needed.
+            glDrawElements(drawMode, (GLsizei)numIndices(), GL_UNSIGNED_INT, 0);
+        }
+        vao->release();
+    }
+
+    //! Draws the commands of `commandBuffer` in `groups`, each with the
+    //! program of `permutations` for its features, e.g., the groups of
+    //! SceneCuller. `setup` is called with each program after it is bound.
+    void drawIndirect(GLuint drawMode, GLuint commandBuffer, const std::vector<DrawGroup> &groups,
+                      ShaderPermutations &permutations,
+                      const std::function<void(QOpenGLShaderProgram &)> &setup) {
+        static const auto multiDrawElementsIndirect =
+            glProcAddress<GLMultiDrawElementsIndirectProc>("glMultiDrawElementsIndirect", 4, 3);
+        if (!multiDrawElementsIndirect) {
+            printf("[WARNING] glMultiDrawElementsIndirect is not supported.\n");
+            return;
+        }
+
+        updateMaterials();
+
+        vao_->bind();
+        materials_->bind();
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        for (const auto &group : groups) {
+            QOpenGLShaderProgram *program = permutations.program(group.features);
+            if (!program) continue;
+
+            program->bind();
+            setup(*program);
+            multiDrawElementsIndirect(drawMode, GL_UNSIGNED_INT,
+                                      (void*)(group.first * sizeof(DrawElementsIndirectCommand)), group.count, 0);
+            program->release();
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        materials_->release();
         vao_->release();
     }
 
@@ -234,11 +623,29 @@ public:
         return vao;
     }
 
+    //! Replaces the vertices with `objArray`, laid out as they were given
+    //! to fromStructArray() or addVertexAttrib() with float attributes.
+    //! The vertices are written to the next region of a ring buffer, so GPU
+    //! can keep drawing the previous ones.
     template <class T>
     void update(const std::vector<T> &objArray) {
+        const size_t size = sizeof(T) * objArray.size();
+        if (!ring_) {
+            ring_ = std::make_unique<RingBuffer>(size);
+        } else {
+            // Draws of the previous vertices have been issued by now.
+            ring_->fence();
+        }
+        memcpy(ring_->map(size), objArray.data(), size);
+        const size_t offset = ring_->unmap();
+
         vao_->bind();
-        vbo_->bind();
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(T) * objArray.size(), &objArray[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, ring_->bufferId());
+        for (const auto &info : attribInfo_) {
+            glVertexAttribPointer(info.location, info.size, GL_FLOAT, GL_FALSE, vertexStride_,
+                                  (void*)(offset + info.head));
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
         vao_->release();
     }
 
@@ -256,8 +663,10 @@ public:
         for (int i = 0; i < tupleSizes.size(); i++) {
             vao->glEnableVertexAttribArray(i);
             vao->glVertexAttribPointer(i, tupleSizes[i], GL_FLOAT, GL_FALSE, sizeof(T), (void*)(offset * sizeof(float)));
+            vao->attribInfo_.emplace_back(i, offset * sizeof(float), tupleSizes[i]);
             offset += tupleSizes[i];
         }
+        vao->vertexStride_ = sizeof(T);
 
         // Write index array.
         vao->indices_.resize(objArray.size());
@@ -266,6 +675,9 @@ public:
         }
         vao->ibo_->bind();
         vao->ibo_->allocate(&vao->indices_[0], vao->indices_.size() * sizeof(uint32_t));
+        vao->numIndices_ = vao->indices_.size();
+        vao->vertexBytes_ = objArray.size() * sizeof(T);
+        vao->indexBytes_ = vao->indices_.size() * sizeof(uint32_t);
 
         vao->vao_->release();
 
@@ -273,6 +685,351 @@ public:
     }
 
 private:
+    //! Packs vertexData_ according to layout_ and uploads it to the bound VBO.
+    void allocateInterleaved() {
+        std::map<uint32_t, const AttribInfo*> sources;
+        for (const auto &info : attribInfo_) {
+            sources[info.location] = &info;
+        }
+
+        // Attributes are added for the same vertices, so the count follows
+        // from the total number of floats.
+        size_t floatsPerVertex = 0;
+        for (const auto &info : attribInfo_) {
+            floatsPerVertex += info.size;
+        }
+        const size_t numVertices = floatsPerVertex > 0 ? vertexData_.size() / floatsPerVertex : 0;
+
+        const int stride = layout_.stride();
+        std::vector<uint8_t> packed(numVertices * stride, 0);
+        dequant_.clear();
+
+        for (const auto &attrib : layout_.attribs()) {
+            auto it = sources.find(attrib.location);
+            if (it == sources.end()) {
+                printf("[WARNING] no data for vertex attribute %u.\n", attrib.location);
+                continue;
+            }
+            const float *src = &vertexData_[it->second->head / sizeof(float)];
+            const int n = attrib.tupleSize;
+
+            float lower[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            float scale[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+            if (attrib.format == VertexFormat::UNorm16 && numVertices > 0) {
+                for (int k = 0; k < n; k++) {
+                    float lo = src[k], hi = src[k];
+                    for (size_t v = 1; v < numVertices; v++) {
+                        lo = std::min(lo, src[v * n + k]);
+                        hi = std::max(hi, src[v * n + k]);
+                    }
+                    lower[k] = lo;
+                    scale[k] = hi > lo ? hi - lo : 1.0f;
+                }
+                dequant_[attrib.location] = std::make_pair(QVector3D(scale[0], scale[1], scale[2]),
+                                                           QVector3D(lower[0], lower[1], lower[2]));
+            }
+
+            for (size_t v = 0; v < numVertices; v++) {
+                uint8_t *dst = &packed[v * stride + attrib.offset];
+                const float *value = &src[v * n];
+                switch (attrib.format) {
+                case VertexFormat::Float:
+                    memcpy(dst, value, n * sizeof(float));
+                    break;
+                case VertexFormat::Half:
+                    for (int k = 0; k < n; k++) {
+                        const uint16_t h = toHalf(value[k]);
+                        memcpy(dst + k * 2, &h, 2);
+                    }
+                    break;
+                case VertexFormat::UNorm16:
+                    for (int k = 0; k < n; k++) {
+                        const float t = (value[k] - lower[k]) / scale[k];
+                        const uint16_t q = (uint16_t)(std::min(std::max(t, 0.0f), 1.0f) * 65535.0f + 0.5f);
+                        memcpy(dst + k * 2, &q, 2);
+                    }
+                    break;
+                case VertexFormat::SNorm10_10_10_2: {
+                    uint32_t word = 0;
+                    for (int k = 0; k < std::min(n, 3); k++) {
+                        const float c = std::min(std::max(value[k], -1.0f), 1.0f);
+                        const int32_t q = (int32_t)std::round(c * 511.0f);
+                        word |= ((uint32_t)q & 0x3ffu) << (10 * k);
+                    }
+                    memcpy(dst, &word, 4);
+                    break;
+                }
+                }
+            }
+        }
+
+        allocateImmutable(*vbo_, packed.data(), packed.size());
+        vertexBytes_ = packed.size();
+        for (const auto &attrib : layout_.attribs()) {
+            setAttribPointer(attrib, stride, attrib.offset);
+        }
+
+        // Positions for the depth pass, packed without the other attributes.
+        for (const auto &attrib : layout_.attribs()) {
+            if ((int)attrib.location != depthLocation_) {
+                continue;
+            }
+
+            const size_t size = depthStride(attrib);
+            std::vector<uint8_t> positions(numVertices * size);
+            for (size_t v = 0; v < numVertices; v++) {
+                memcpy(&positions[v * size], &packed[v * stride + attrib.offset], size);
+            }
+
+            depthVbo_ = new QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+            depthVbo_->create();
+            depthVbo_->bind();
+            allocateImmutable(*depthVbo_, positions.data(), positions.size());
+            depthVbo_->release();
+            vertexBytes_ += positions.size();
+            vbo_->bind();
+        }
+    }
+
+    //! Stride of the depth stream. Positions are padded to 4 bytes, so it
+    //! is not the tight stride GL assumes for 0, e.g., 8 bytes for UNorm16.
+    static int depthStride(const VertexLayout::Attrib &attrib) {
+        return (VertexLayout::byteSize(attrib.tupleSize, attrib.format) + 3) & ~3;
+    }
+
+    void setAttribPointer(const VertexLayout::Attrib &attrib, int stride, size_t offset) {
+        glEnableVertexAttribArray(attrib.location);
+        switch (attrib.format) {
+        case VertexFormat::Float:
+            glVertexAttribPointer(attrib.location, attrib.tupleSize, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+            break;
+        case VertexFormat::Half:
+            glVertexAttribPointer(attrib.location, attrib.tupleSize, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offset);
+            break;
+        case VertexFormat::UNorm16:
+            glVertexAttribPointer(attrib.location, attrib.tupleSize, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offset);
+            break;
+        case VertexFormat::SNorm10_10_10_2:
+            glVertexAttribPointer(attrib.location, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)offset);
+            break;
+        }
+    }
+
+    //! VAO of the depth stream, sharing the index buffer. The planar layout
+    //! already stores positions in a block of their own.
+    void setupDepthVao() {
+        depthVao_ = new QOpenGLVertexArrayObject();
+        depthVao_->create();
+        depthVao_->bind();
+        ibo_->bind();
+
+        if (depthVbo_) {
+            for (const auto &attrib : layout_.attribs()) {
+                if ((int)attrib.location == depthLocation_) {
+                    depthVbo_->bind();
+                    setAttribPointer(attrib, depthStride(attrib), 0);
+                }
+            }
+        } else {
+            vbo_->bind();
+            for (const auto &info : attribInfo_) {
+                if ((int)info.location == depthLocation_) {
+                    glEnableVertexAttribArray(info.location);
+                    glVertexAttribPointer(info.location, info.size, GL_FLOAT, GL_FALSE, 0, (void*)info.head);
+                }
+            }
+        }
+
+        depthVao_->release();
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    //! Uploads the materials and the segment indices read by the shaders.
+    void updateMaterials() {
+        if (!materialsDirty_ && materials_) {
+            return;
+        }
+
+        if (!materials_) {
+            materials_ = std::make_unique<MaterialTable>();
+        }
+        materials_->update(segmentInfo_);
+
+        if (segmentInfo_.size() > drawIdCapacity_) {
+            drawIdCapacity_ = std::max(segmentInfo_.size(), drawIdCapacity_ * 2);
+            std::vector<uint32_t> ids(drawIdCapacity_);
+            for (size_t i = 0; i < ids.size(); i++) {
+                ids[i] = (uint32_t)i;
+            }
+
+            auto func = QOpenGLContext::currentContext()->extraFunctions();
+            if (!drawIdBuffer_) {
+                glGenBuffers(1, &drawIdBuffer_);
+            }
+            vao_->bind();
+            glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer_);
+            glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(uint32_t), ids.data(), GL_STATIC_DRAW);
+            glEnableVertexAttribArray(kMaterialLocation);
+            func->glVertexAttribIPointer(kMaterialLocation, 1, GL_UNSIGNED_INT, 0, nullptr);
+            func->glVertexAttribDivisor(kMaterialLocation, 1);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            vao_->release();
+        }
+
+        // Segment i reads material i through its base instance. Commands
+        // are sorted by the features of the materials to draw in groups.
+        std::vector<uint32_t> features(segmentInfo_.size());
+        drawOrder_.resize(segmentInfo_.size());
+        for (size_t i = 0; i < segmentInfo_.size(); i++) {
+            features[i] = materialFeatures(segmentInfo_[i].material);
+            drawOrder_[i] = (uint32_t)i;
+        }
+        std::stable_sort(drawOrder_.begin(), drawOrder_.end(), [&](uint32_t a, uint32_t b) {
+            return features[a] < features[b];
+        });
+
+        std::vector<DrawElementsIndirectCommand> commands(segmentInfo_.size());
+        std::vector<uint32_t> sortedFeatures(segmentInfo_.size());
+        for (size_t k = 0; k < drawOrder_.size(); k++) {
+            const uint32_t i = drawOrder_[k];
+            commands[k].count = (uint32_t)segmentInfo_[i].count;
+            commands[k].instanceCount = 1;
+            commands[k].firstIndex = (uint32_t)segmentInfo_[i].start;
+            commands[k].baseVertex = 0;
+            commands[k].baseInstance = i;
+            sortedFeatures[k] = features[i];
+        }
+        drawGroups_ = makeDrawGroups(sortedFeatures);
+        if (!indirectBuffer_) {
+            glGenBuffers(1, &indirectBuffer_);
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer_);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, std::max(commands.size(), (size_t)1) * sizeof(DrawElementsIndirectCommand),
+                     commands.empty() ? nullptr : commands.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+        materialsDirty_ = false;
+    }
+
+    //! IEEE 754 binary16 with round-to-nearest-even.
+    static uint16_t toHalf(float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, 4);
+        const uint32_t sign = (bits >> 16) & 0x8000u;
+        const uint32_t absBits = bits & 0x7fffffffu;
+
+        if (absBits >= 0x7f800000u) {
+            // Inf or NaN.
+            return (uint16_t)(sign | 0x7c00u | (absBits > 0x7f800000u ? 0x200u : 0u));
+        }
+        if (absBits >= 0x477ff000u) {
+            // Overflows to Inf.
+            return (uint16_t)(sign | 0x7c00u);
+        }
+        if (absBits < 0x38800000u) {
+            // Subnormal or zero.
+            if (absBits < 0x33000000u) {
+                return (uint16_t)sign;
+            }
+            const uint32_t e = absBits >> 23;
+            const uint32_t m = (absBits & 0x7fffffu) | 0x800000u;
+            const uint32_t shift = 126 - e;
+            uint32_t h = m >> shift;
+            const uint32_t rest = m & ((1u << shift) - 1);
+            const uint32_t halfway = 1u << (shift - 1);
+            if (rest > halfway || (rest == halfway && (h & 1u))) {
+                h++;
+            }
+            return (uint16_t)(sign | h);
+        }
+
+        uint32_t h = ((absBits - 0x38000000u) >> 13);
+        const uint32_t rest = absBits & 0x1fffu;
+        if (rest > 0x1000u || (rest == 0x1000u && (h & 1u))) {
+            h++;
+        }
+        return (uint16_t)(sign | h);
+    }
+
+    //! Grows the stream buffers to hold at least the given numbers of
+    //! vertices and indices. Data appended so far are copied on GPU.
+    void reserveStream(size_t numVertices, size_t numIndices) {
+        auto func = QOpenGLContext::currentContext()->extraFunctions();
+
+        if (numVertices > vertexCapacity_) {
+            const size_t capacity = std::max(numVertices, vertexCapacity_ * 2);
+            size_t stride = 0;
+            for (int tupleSize : streamTupleSizes_) {
+                stride += tupleSize;
+            }
+
+            QOpenGLBuffer *vbo = new QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+            vbo->create();
+            vbo->setUsagePattern(QOpenGLBuffer::DynamicDraw);
+            vbo->bind();
+            vbo->allocate(capacity * stride * sizeof(float));
+
+            glBindBuffer(GL_COPY_READ_BUFFER, vbo_->bufferId());
+            glBindBuffer(GL_COPY_WRITE_BUFFER, vbo->bufferId());
+            size_t head = 0;
+            for (int tupleSize : streamTupleSizes_) {
+                if (numStreamVertices_ > 0) {
+                    func->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                              head * vertexCapacity_ * sizeof(float),
+                                              head * capacity * sizeof(float),
+                                              numStreamVertices_ * tupleSize * sizeof(float));
+                }
+                head += tupleSize;
+            }
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+            delete vbo_;
+            vbo_ = vbo;
+            vertexCapacity_ = capacity;
+            vertexBytes_ = capacity * stride * sizeof(float);
+
+            vao_->bind();
+            vbo_->bind();
+            head = 0;
+            for (int i = 0; i < streamTupleSizes_.size(); i++) {
+                glEnableVertexAttribArray(i);
+                glVertexAttribPointer(i, streamTupleSizes_[i], GL_FLOAT, GL_FALSE, 0,
+                                      (void*)(head * capacity * sizeof(float)));
+                head += streamTupleSizes_[i];
+            }
+            vao_->release();
+            vbo_->release();
+        }
+
+        if (numIndices > indexCapacity_) {
+            const size_t capacity = std::max(numIndices, indexCapacity_ * 2);
+
+            QOpenGLBuffer *ibo = new QOpenGLBuffer(QOpenGLBuffer::IndexBuffer);
+            ibo->create();
+            ibo->setUsagePattern(QOpenGLBuffer::DynamicDraw);
+
+            glBindBuffer(GL_COPY_WRITE_BUFFER, ibo->bufferId());
+            glBufferData(GL_COPY_WRITE_BUFFER, capacity * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+            if (numStreamIndices_ > 0) {
+                glBindBuffer(GL_COPY_READ_BUFFER, ibo_->bufferId());
+                func->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                                          numStreamIndices_ * sizeof(uint32_t));
+                glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            }
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+            delete ibo_;
+            ibo_ = ibo;
+            indexCapacity_ = capacity;
+            indexBytes_ = capacity * sizeof(uint32_t);
+
+            vao_->bind();
+            ibo_->bind();
+            vao_->release();
+        }
+    }
+
     void initialize() {
         initializeOpenGLFunctions();
 
@@ -282,7 +1039,7 @@ private:
 
         vbo_ = new QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
         vbo_->create();
-        vbo_->setUsagePattern(QOpenGLBuffer::DynamicDraw);
+        vbo_->setUsagePattern(QOpenGLBuffer::StaticDraw);
         vbo_->bind();
         vbo_->release();
 
@@ -303,6 +1060,34 @@ private:
     std::vector<uint32_t> indices_;
     std::vector<AttribInfo> attribInfo_;
     std::vector<SegmentInfo> segmentInfo_;
+
+    VertexLayout layout_;
+    std::map<uint32_t, std::pair<QVector3D, QVector3D>> dequant_;
+
+    std::vector<int> streamTupleSizes_;
+    size_t vertexCapacity_ = 0;
+    size_t indexCapacity_ = 0;
+    size_t numStreamVertices_ = 0;
+    size_t numStreamIndices_ = 0;
+
+    GLsizei vertexStride_ = 0;
+    size_t numIndices_ = 0;
+    size_t vertexBytes_ = 0;
+    size_t indexBytes_ = 0;
+    std::unique_ptr<RingBuffer> ring_ = nullptr;
+
+    std::unique_ptr<MaterialTable> materials_ = nullptr;
+    bool materialsDirty_ = true;
+    GLuint drawIdBuffer_ = 0;
+    size_t drawIdCapacity_ = 0;
+    GLuint indirectBuffer_ = 0;
+    std::vector<uint32_t> drawOrder_;     //! Segments sorted by their features.
+    std::vector<DrawGroup> drawGroups_;   //! Groups of drawOrder_.
+
+    int depthLocation_ = -1;
+    QOpenGLVertexArrayObject *depthVao_ = nullptr;
+    QOpenGLBuffer *depthVbo_ = nullptr;
+    bool multiDrawIndirect_ = true;
 };
 
 #endif  // _VERTEXARRAYOBJECT_H_